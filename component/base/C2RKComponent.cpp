@@ -16,6 +16,7 @@
 
 #include <media/stagefright/foundation/AMessage.h>
 #include <inttypes.h>
+#include <algorithm>
 
 #include <C2Config.h>
 #include <C2Debug.h>
@@ -28,6 +29,8 @@ namespace android {
 
 C2_LOGGER_ENABLE("C2RKComponent");
 
+static constexpr int32_t kMaxProcessCountPerMessage = 8;
+
 std::unique_ptr<C2Work> C2RKComponent::WorkQueue::pop_front() {
     std::unique_ptr<C2Work> work = std::move(mQueue.front().work);
     mQueue.pop_front();
@@ -54,6 +57,73 @@ void C2RKComponent::WorkQueue::markDrain(uint32_t drainMode) {
     mQueue.push_back({ nullptr, drainMode });
 }
 
+std::deque<C2RKComponent::PendingWork::Entry>::const_iterator
+C2RKComponent::PendingWork::lowerBound(uint64_t frameIndex) const {
+    return std::lower_bound(
+            mEntries.begin(), mEntries.end(), frameIndex,
+            [](const Entry &entry, uint64_t index) {
+                return entry.frameIndex < index;
+            });
+}
+
+bool C2RKComponent::PendingWork::contains(uint64_t frameIndex) const {
+    return (peek(frameIndex) != nullptr);
+}
+
+C2Work *C2RKComponent::PendingWork::peek(uint64_t frameIndex) const {
+    auto it = lowerBound(frameIndex);
+    if (it == mEntries.end() || it->frameIndex != frameIndex) {
+        return nullptr;
+    }
+    return it->work.get();
+}
+
+size_t C2RKComponent::PendingWork::countBefore(uint64_t frameIndex) const {
+    return std::distance(mEntries.begin(), lowerBound(frameIndex));
+}
+
+std::unique_ptr<C2Work> C2RKComponent::PendingWork::put(
+        uint64_t frameIndex, std::unique_ptr<C2Work> work) {
+    // fast path, frameIndex is increasing in most cases
+    if (mEntries.empty() || mEntries.back().frameIndex < frameIndex) {
+        mEntries.push_back({ frameIndex, std::move(work) });
+        return nullptr;
+    }
+
+    auto it = mEntries.begin() + std::distance(mEntries.cbegin(), lowerBound(frameIndex));
+    if (it != mEntries.end() && it->frameIndex == frameIndex) {
+        std::swap(it->work, work);
+        return work;
+    }
+    std::ignore = mEntries.insert(it, { frameIndex, std::move(work) });
+    return nullptr;
+}
+
+std::unique_ptr<C2Work> C2RKComponent::PendingWork::take(uint64_t frameIndex) {
+    std::unique_ptr<C2Work> work;
+
+    if (!mEntries.empty() && mEntries.front().frameIndex == frameIndex) {
+        return takeOldest();
+    }
+
+    auto it = mEntries.begin() + std::distance(mEntries.cbegin(), lowerBound(frameIndex));
+    if (it != mEntries.end() && it->frameIndex == frameIndex) {
+        work = std::move(it->work);
+        std::ignore = mEntries.erase(it);
+    }
+    return work;
+}
+
+std::unique_ptr<C2Work> C2RKComponent::PendingWork::takeOldest() {
+    std::unique_ptr<C2Work> work;
+
+    if (!mEntries.empty()) {
+        work = std::move(mEntries.front().work);
+        mEntries.pop_front();
+    }
+    return work;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 C2RKComponent::WorkHandler::WorkHandler() : mRunning(false) {}
@@ -134,9 +204,15 @@ void C2RKComponent::WorkHandler::onMessageReceived(const sp<AMessage> &msg) {
     }
 }
 
+/*
+ * Fetch of output block returns C2_BLOCKING while the consumer holds all
+ * buffers. Instead of re-fetching in a busy loop, park the caller with
+ * exponential back-off, and wake it up immediately on flushing.
+ */
 class C2RKComponent::BlockingBlockPool : public C2BlockPool {
 public:
-    BlockingBlockPool(const std::shared_ptr<C2BlockPool>& base): mBase{base} {}
+    BlockingBlockPool(const std::shared_ptr<C2BlockPool>& base, C2RKComponent *owner)
+        : mBase{base}, mOwner(owner) {}
 
     virtual local_id_t getLocalId() const override {
         return mBase->getLocalId();
@@ -150,38 +226,59 @@ public:
             uint32_t capacity,
             C2MemoryUsage usage,
             std::shared_ptr<C2LinearBlock>* block) {
-        c2_status_t status;
-        do {
-            status = mBase->fetchLinearBlock(capacity, usage, block);
-        } while (status == C2_BLOCKING);
-        return status;
+        return fetchBlocking([&]() {
+            return mBase->fetchLinearBlock(capacity, usage, block);
+        });
     }
 
     virtual c2_status_t fetchCircularBlock(
             uint32_t capacity,
             C2MemoryUsage usage,
             std::shared_ptr<C2CircularBlock>* block) {
-        c2_status_t status;
-        do {
-            status = mBase->fetchCircularBlock(capacity, usage, block);
-        } while (status == C2_BLOCKING);
-        return status;
+        return fetchBlocking([&]() {
+            return mBase->fetchCircularBlock(capacity, usage, block);
+        });
     }
 
     virtual c2_status_t fetchGraphicBlock(
             uint32_t width, uint32_t height, uint32_t format,
             C2MemoryUsage usage,
             std::shared_ptr<C2GraphicBlock>* block) {
-        c2_status_t status;
-        do {
-            status = mBase->fetchGraphicBlock(width, height, format, usage,
-                                              block);
-        } while (status == C2_BLOCKING);
-        return status;
+        return fetchBlocking([&]() {
+            return mBase->fetchGraphicBlock(width, height, format, usage, block);
+        });
     }
 
 private:
+    template <typename FetchFunc>
+    c2_status_t fetchBlocking(FetchFunc fetch) {
+        c2_status_t status = fetch();
+        if (status != C2_BLOCKING) {
+            return status;
+        }
+
+        int64_t startTimeUs = ALooper::GetNowUs();
+        int64_t backoffUs = kFetchMinBackoffUs;
+
+        while (status == C2_BLOCKING) {
+            if (!mOwner->waitFetchBackoff(backoffUs)) {
+                Log.D("block fetch canceled since pending flush");
+                status = C2_CANCELED;
+                break;
+            }
+            backoffUs = std::min(backoffUs * 2, kFetchMaxBackoffUs);
+            status = fetch();
+        }
+
+        mOwner->recordFetchStall(ALooper::GetNowUs() - startTimeUs);
+        return status;
+    }
+
+    static constexpr int64_t kFetchMinBackoffUs = 500;
+    static constexpr int64_t kFetchMaxBackoffUs = 8000;
+
     std::shared_ptr<C2BlockPool> mBase;
+    C2RKComponent *mOwner;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -198,6 +295,7 @@ C2RKComponent::C2RKComponent(
         const std::shared_ptr<C2ComponentInterface> &intf)
     : mDummyReadView(DummyReadView()),
       mIntf(intf),
+      mExecWord(UNINITIALIZED),
       mLooper(new ALooper),
       mHandler(new WorkHandler) {
     mLooper->setName(intf->getName().c_str());
@@ -216,14 +314,14 @@ c2_status_t C2RKComponent::setListener_vb(
     mHandler->setComponent(shared_from_this());
 
     Mutexed<ExecState>::Locked state(mExecState);
-    if (state->mState == RUNNING) {
+    if (getExecState() == RUNNING) {
         if (listener) {
             return C2_BAD_STATE;
         } else if (!mayBlock) {
             return C2_BLOCKING;
         }
     }
-    state->mListener = listener;
+    std::atomic_store(&mListener, listener);
     // TODO: wait for listener change to have taken place before returning
     // (e.g. if there is an ongoing listener callback)
 
@@ -235,11 +333,8 @@ std::shared_ptr<C2RKComponent> C2RKComponent::sharedFromComponent() {
 }
 
 c2_status_t C2RKComponent::queue_nb(std::list<std::unique_ptr<C2Work>> * const items) {
-    {
-        Mutexed<ExecState>::Locked state(mExecState);
-        if (state->mState != RUNNING) {
-            return C2_BAD_STATE;
-        }
+    if (getExecState() != RUNNING) {
+        return C2_BAD_STATE;
     }
     bool queueWasEmpty = false;
     {
@@ -266,11 +361,8 @@ c2_status_t C2RKComponent::flush_sm(
         flush_mode_t flushMode, std::list<std::unique_ptr<C2Work>>* const flushedWork) {
     Log.TraceEnter();
     (void)flushMode;
-    {
-        Mutexed<ExecState>::Locked state(mExecState);
-        if (state->mState != RUNNING) {
-            return C2_BAD_STATE;
-        }
+    if (getExecState() != RUNNING) {
+        return C2_BAD_STATE;
     }
     {
         Mutexed<WorkQueue>::Locked queue(mWorkQueue);
@@ -288,8 +380,7 @@ c2_status_t C2RKComponent::flush_sm(
             }
         }
         while (!queue->pending().empty()) {
-            flushedWork->push_back(std::move(queue->pending().begin()->second));
-            std::ignore = queue->pending().erase(queue->pending().begin());
+            flushedWork->push_back(queue->pending().takeOldest());
         }
     }
 
@@ -301,11 +392,8 @@ c2_status_t C2RKComponent::drain_nb(drain_mode_t drainMode) {
     if (drainMode == DRAIN_CHAIN) {
         return C2_OMITTED;
     }
-    {
-        Mutexed<ExecState>::Locked state(mExecState);
-        if (state->mState != RUNNING) {
-            return C2_BAD_STATE;
-        }
+    if (getExecState() != RUNNING) {
+        return C2_BAD_STATE;
     }
     bool queueWasEmpty = false;
     {
@@ -322,11 +410,11 @@ c2_status_t C2RKComponent::drain_nb(drain_mode_t drainMode) {
 c2_status_t C2RKComponent::start() {
     Log.TraceEnter();
     Mutexed<ExecState>::Locked state(mExecState);
-    if (state->mState == RUNNING) {
+    if (getExecState() == RUNNING) {
         return C2_BAD_STATE;
     }
 
-    bool needsInit = (state->mState == UNINITIALIZED);
+    bool needsInit = (getExecState() == UNINITIALIZED);
     state.unlock();
 
     if (needsInit) {
@@ -343,7 +431,7 @@ c2_status_t C2RKComponent::start() {
         CHECK((new AMessage(WorkHandler::kWhatStart, mHandler))->post() == OK);
     }
     state.lock();
-    state->mState = RUNNING;
+    setExecState_l(RUNNING);
 
     return C2_OK;
 }
@@ -357,10 +445,10 @@ c2_status_t C2RKComponent::stop() {
 
     {
         Mutexed<ExecState>::Locked state(mExecState);
-        if (state->mState != RUNNING) {
+        if (getExecState() != RUNNING) {
             return C2_BAD_STATE;
         }
-        state->mState = STOPPED;
+        setExecState_l(STOPPED);
     }
     {
         Mutexed<WorkQueue>::Locked queue(mWorkQueue);
@@ -387,7 +475,7 @@ c2_status_t C2RKComponent::reset() {
 
     {
         Mutexed<ExecState>::Locked state(mExecState);
-        state->mState = UNINITIALIZED;
+        setExecState_l(UNINITIALIZED);
     }
     {
         Mutexed<WorkQueue>::Locked queue(mWorkQueue);
@@ -433,57 +521,106 @@ std::list<std::unique_ptr<C2Work>> vec(std::unique_ptr<C2Work> &work) {
 
 }  // namespace
 
+void C2RKComponent::setExecState_l(int state) {
+    uint32_t word = mExecWord.load(std::memory_order_relaxed);
+    word = (word & ~kExecStateMask) | static_cast<uint32_t>(state);
+    mExecWord.store(word, std::memory_order_release);
+}
+
+void C2RKComponent::setFlushing_l(bool flushing) {
+    if (flushing) {
+        std::ignore = mExecWord.fetch_or(kExecFlushing, std::memory_order_release);
+    } else {
+        std::ignore = mExecWord.fetch_and(~kExecFlushing, std::memory_order_release);
+    }
+}
+
 // In flushing state, discard work output
 void C2RKComponent::setFlushingState() {
-    Mutexed<ExecState>::Locked state(mExecState);
-    state->mFlushing = true;
+    {
+        Mutexed<ExecState>::Locked state(mExecState);
+        setFlushing_l(true);
+        mFetchCond.broadcast();
+    }
+    onFlushPending();
 }
 
 void C2RKComponent::stopFlushingState() {
     Mutexed<ExecState>::Locked state(mExecState);
-    state->mFlushing = false;
+    setFlushing_l(false);
 }
 
 bool C2RKComponent::isPendingFlushing() {
-    Mutexed<ExecState>::Locked state(mExecState);
-    return state->mFlushing;
+    return (mExecWord.load(std::memory_order_acquire) & kExecFlushing) != 0;
 }
 
 bool C2RKComponent::isPendingWorkExist(uint64_t frameIndex) {
     Mutexed<WorkQueue>::Locked queue(mWorkQueue);
-    return (queue->pending().count(frameIndex) > 0);
+    return queue->pending().contains(frameIndex);
+}
+
+bool C2RKComponent::waitPendingWork(uint64_t frameIndex, int64_t timeoutUs) {
+    int64_t deadlineUs = ALooper::GetNowUs() + timeoutUs;
+
+    Mutexed<WorkQueue>::Locked queue(mWorkQueue);
+    while (!queue->pending().contains(frameIndex)) {
+        int64_t remainUs = deadlineUs - ALooper::GetNowUs();
+        if (remainUs <= 0 || isPendingFlushing()) {
+            return false;
+        }
+        std::ignore = queue.waitForConditionRelative(mPendingCond, remainUs * 1000LL);
+    }
+    return true;
 }
 
 int C2RKComponent::getPendingWorkCountBeforeFrame(uint64_t frameIndex) {
     Mutexed<WorkQueue>::Locked queue(mWorkQueue);
-    return std::count_if(
-                queue->pending().begin(),  queue->pending().end(),
-                [frameIndex](const auto& value) {
-                    return (value.second->input.ordinal.frameIndex < frameIndex);
-                });
+    return static_cast<int>(queue->pending().countBefore(frameIndex));
+}
+
+bool C2RKComponent::waitFetchBackoff(int64_t timeUs) {
+    Mutexed<ExecState>::Locked state(mExecState);
+    if (!isPendingFlushing()) {
+        std::ignore = state.waitForConditionRelative(mFetchCond, timeUs * 1000LL);
+    }
+    return !isPendingFlushing();
+}
+
+void C2RKComponent::recordFetchStall(int64_t stallUs) {
+    Mutexed<ExecState>::Locked state(mExecState);
+    state->mFetchStallCount++;
+    state->mFetchStallTotalUs += stallUs;
+    state->mFetchStallMaxUs = std::max(state->mFetchStallMaxUs, stallUs);
+}
+
+void C2RKComponent::getFetchStallStats(int64_t *count, int64_t *totalUs, int64_t *maxUs) {
+    Mutexed<ExecState>::Locked state(mExecState);
+    *count = state->mFetchStallCount;
+    *totalUs = state->mFetchStallTotalUs;
+    *maxUs = state->mFetchStallMaxUs;
 }
 
 void C2RKComponent::finishAllPendingWorks() {
     Mutexed<WorkQueue>::Locked queue(mWorkQueue);
     while (!queue->pending().empty()) {
-        std::unique_ptr<C2Work> work = std::move(queue->pending().begin()->second);
+        std::unique_ptr<C2Work> work = queue->pending().takeOldest();
+        uint64_t frameIndex = work->input.ordinal.frameIndex.peeku();
 
         work->worklets.front()->output.flags = (C2FrameData::flags_t)0;
         work->worklets.front()->output.buffers.clear();
         work->worklets.front()->output.ordinal = work->input.ordinal;
         work->workletsProcessed = 1u;
 
-        std::shared_ptr<C2Component::Listener> listener = mExecState.lock()->mListener;
+        std::shared_ptr<C2Component::Listener> listener = getListener();
         listener->onWorkDone_nb(shared_from_this(), vec(work));
-        Log.D("flush pending work, index %lld", queue->pending().begin()->first);
-
-        std::ignore = queue->pending().erase(queue->pending().begin());
+        Log.D("flush pending work, index %" PRIu64, frameIndex);
     }
 }
 
 void C2RKComponent::finish(
         uint64_t frameIndex,
-        std::function<void(const std::unique_ptr<C2Work> &)> fillWork) {
+        C2RKFillWorkRef fillWork,
+        std::list<std::unique_ptr<C2Work>> *batch) {
 
     std::unique_ptr<C2Work> work;
 
@@ -496,20 +633,20 @@ void C2RKComponent::finish(
             return;
         }
 
-        if (queue->pending().count(frameIndex) == 0) {
+        work = queue->pending().take(frameIndex);
+        if (!work) {
             Log.W("unknown frame index: %" PRIu64, frameIndex);
             return;
         }
-        work = std::move(queue->pending().at(frameIndex));
-        std::ignore = queue->pending().erase(frameIndex);
     }
 
-    finish(work, fillWork);
+    finish(work, fillWork, batch);
 }
 
 void C2RKComponent::finish(
         std::unique_ptr<C2Work> &work,
-        std::function<void(const std::unique_ptr<C2Work> &)> fillWork) {
+        C2RKFillWorkRef fillWork,
+        std::list<std::unique_ptr<C2Work>> *batch) {
     if (!work) {
         return;
     }
@@ -521,38 +658,80 @@ void C2RKComponent::finish(
     }
 
     fillWork(work);
-    std::shared_ptr<C2Component::Listener> listener = mExecState.lock()->mListener;
+    if (batch) {
+        batch->push_back(std::move(work));
+        return;
+    }
+
+    std::shared_ptr<C2Component::Listener> listener = getListener();
     listener->onWorkDone_nb(shared_from_this(), vec(work));
     Log.D("returning pending work");
 }
 
+void C2RKComponent::finishBatch(std::list<std::unique_ptr<C2Work>> *batch) {
+    if (batch->empty()) {
+        return;
+    }
+
+    if (isPendingFlushing()) {
+        Log.D("ignore %zu batched works output since pending flush", batch->size());
+        batch->clear();
+        return;
+    }
+
+    size_t count = batch->size();
+    std::shared_ptr<C2Component::Listener> listener = getListener();
+    listener->onWorkDone_nb(shared_from_this(), std::move(*batch));
+    batch->clear();
+    Log.D("returning %zu batched works", count);
+}
+
 void C2RKComponent::cloneAndSend(
         uint64_t frameIndex,
         const std::unique_ptr<C2Work> &currentWork,
-        std::function<void(const std::unique_ptr<C2Work> &)> fillWork) {
+        C2RKFillWorkRef fillWork) {
     std::unique_ptr<C2Work> work(new C2Work);
-    if (currentWork->input.ordinal.frameIndex == frameIndex) {
+    if (currentWork && currentWork->input.ordinal.frameIndex == frameIndex) {
         work->input.flags = currentWork->input.flags;
         work->input.ordinal = currentWork->input.ordinal;
     } else {
         Mutexed<WorkQueue>::Locked queue(mWorkQueue);
-        if (queue->pending().count(frameIndex) == 0) {
+        C2Work *pending = queue->pending().peek(frameIndex);
+        if (pending == nullptr) {
             Log.W("unknown frame index: %" PRIu64, frameIndex);
             return;
         }
-        work->input.flags = queue->pending().at(frameIndex)->input.flags;
-        work->input.ordinal = queue->pending().at(frameIndex)->input.ordinal;
+        work->input.flags = pending->input.flags;
+        work->input.ordinal = pending->input.ordinal;
     }
     std::ignore = work->worklets.emplace_back(new C2Worklet);
     if (work) {
         fillWork(work);
-        std::shared_ptr<C2Component::Listener> listener = mExecState.lock()->mListener;
+        std::shared_ptr<C2Component::Listener> listener = getListener();
         listener->onWorkDone_nb(shared_from_this(), vec(work));
         Log.D("cloned and sending work");
     }
 }
 
 bool C2RKComponent::processQueue() {
+    bool hasQueuedWork = false;
+
+    /*
+     * Process several queued works per looper message to save the message
+     * allocation and looper wakeup for each work. The count is limited so
+     * that messages posted behind are not delayed for long.
+     */
+    for (int32_t i = 0; i < kMaxProcessCountPerMessage; i++) {
+        hasQueuedWork = processWork();
+        if (!hasQueuedWork) {
+            break;
+        }
+    }
+
+    return hasQueuedWork;
+}
+
+bool C2RKComponent::processWork() {
     std::unique_ptr<C2Work> work;
     uint64_t generation;
     int32_t drainMode;
@@ -613,14 +792,12 @@ bool C2RKComponent::processQueue() {
                    (unsigned long long)poolId,
                    (unsigned long long)(blockPool ? blockPool->getLocalId() : 111000111), err);
             if (err == C2_OK) {
-                mOutputBlockPool = std::make_shared<BlockingBlockPool>(blockPool);
+                mOutputBlockPool = std::make_shared<BlockingBlockPool>(blockPool, this);
             }
             return err;
         }();
         if (err != C2_OK) {
-            Mutexed<ExecState>::Locked state(mExecState);
-            std::shared_ptr<C2Component::Listener> listener = state->mListener;
-            state.unlock();
+            std::shared_ptr<C2Component::Listener> listener = getListener();
             listener->onError_nb(shared_from_this(), err);
             return hasQueuedWork;
         }
@@ -629,15 +806,13 @@ bool C2RKComponent::processQueue() {
     if (!work) {
         c2_status_t err = drain(drainMode, mOutputBlockPool);
         if (err != C2_OK) {
-            Mutexed<ExecState>::Locked state(mExecState);
-            std::shared_ptr<C2Component::Listener> listener = state->mListener;
-            state.unlock();
+            std::shared_ptr<C2Component::Listener> listener = getListener();
             listener->onError_nb(shared_from_this(), err);
         }
         return hasQueuedWork;
     }
 
-    {
+    if (!work->input.configUpdate.empty()) {
         std::vector<C2Param *> updates;
         for (const std::unique_ptr<C2Param> &param: work->input.configUpdate) {
             if (param) {
@@ -667,38 +842,28 @@ bool C2RKComponent::processQueue() {
         work->result = C2_NOT_FOUND;
         queue.unlock();
 
-        Mutexed<ExecState>::Locked state(mExecState);
-        std::shared_ptr<C2Component::Listener> listener = state->mListener;
-        state.unlock();
+        std::shared_ptr<C2Component::Listener> listener = getListener();
         listener->onWorkDone_nb(shared_from_this(), vec(work));
         return hasQueuedWork;
     }
     if (work->workletsProcessed != 0u) {
         queue.unlock();
-        Mutexed<ExecState>::Locked state(mExecState);
         Log.D("returning this work");
-        std::shared_ptr<C2Component::Listener> listener = state->mListener;
-        state.unlock();
+        std::shared_ptr<C2Component::Listener> listener = getListener();
         listener->onWorkDone_nb(shared_from_this(), vec(work));
     } else {
         Log.D("queue pending work");
         work->input.buffers.clear();
-        std::unique_ptr<C2Work> unexpected;
-
         uint64_t frameIndex = work->input.ordinal.frameIndex.peeku();
-        if (queue->pending().count(frameIndex) != 0) {
-            unexpected = std::move(queue->pending().at(frameIndex));
-            std::ignore = queue->pending().erase(frameIndex);
-        }
-        std::ignore = queue->pending().emplace(frameIndex, std::move(work));
+        std::unique_ptr<C2Work> unexpected =
+                queue->pending().put(frameIndex, std::move(work));
+        mPendingCond.broadcast();
 
         queue.unlock();
         if (unexpected) {
             Log.I("unexpected pending work");
             unexpected->result = C2_CORRUPTED;
-            Mutexed<ExecState>::Locked state(mExecState);
-            std::shared_ptr<C2Component::Listener> listener = state->mListener;
-            state.unlock();
+            std::shared_ptr<C2Component::Listener> listener = getListener();
             listener->onWorkDone_nb(shared_from_this(), vec(unexpected));
         }
     }
@@ -17,18 +17,49 @@
 #ifndef C2_RK_COMPONENT_H_
 #define C2_RK_COMPONENT_H_
 
+#include <atomic>
+#include <deque>
 #include <list>
-#include <unordered_map>
+#include <memory>
+#include <type_traits>
 
 #include <media/stagefright/foundation/AHandler.h>
 #include <media/stagefright/foundation/ALooper.h>
 #include <media/stagefright/foundation/Mutexed.h>
+#include <utils/Condition.h>
 #include <C2Component.h>
 
 #define OUTPUT_WORK_INDEX            INT64_MAX
 
 namespace android {
 
+/*
+ * Non-owning reference to a work fill callable. The fill function is always
+ * invoked before finish()/cloneAndSend() returns, so there is no need to
+ * copy the callable and its captures into heap as std::function does.
+ */
+class C2RKFillWorkRef {
+public:
+    template <typename Func, typename = std::enable_if_t<
+            !std::is_same<std::decay_t<Func>, C2RKFillWorkRef>::value>>
+    C2RKFillWorkRef(Func &&func)  // NOLINT(google-explicit-constructor)
+        : mObj(const_cast<void *>(static_cast<const void *>(std::addressof(func)))),
+          mCall(&invoke<std::remove_reference_t<Func>>) {}
+
+    void operator()(const std::unique_ptr<C2Work> &work) const {
+        mCall(mObj, work);
+    }
+
+private:
+    template <typename Func>
+    static void invoke(void *obj, const std::unique_ptr<C2Work> &work) {
+        (*static_cast<Func *>(obj))(work);
+    }
+
+    void *mObj;
+    void (*mCall)(void *obj, const std::unique_ptr<C2Work> &work);
+};
+
 class C2RKComponent
         : public C2Component, public std::enable_shared_from_this<C2RKComponent> {
 public:
@@ -86,6 +117,13 @@ protected:
      */
     virtual c2_status_t onFlush_sm() = 0;
 
+    /**
+     * Called from the client thread once flushing state is set, before the
+     * flush/stop request reaches the work looper. Derived components use it
+     * to wake up any blocking wait in process().
+     */
+    virtual void onFlushPending() {}
+
     /**
      * Process the given work and finish pending work using finish().
      *
@@ -122,11 +160,23 @@ protected:
      */
     bool isPendingWorkExist(uint64_t frameIndex);
 
+    /**
+     * wait until the work with frameIndex is queued as pending, for output
+     * taken on another thread before process() of the work has returned.
+     * return false on timeout or pending flush.
+     */
+    bool waitPendingWork(uint64_t frameIndex, int64_t timeoutUs);
+
     /**
      * Retrieves the number of pending work items scheduled before frameIndex
      */
     int getPendingWorkCountBeforeFrame(uint64_t frameIndex);
 
+    /**
+     * Retrieves the stall statistics of output block fetch
+     */
+    void getFetchStallStats(int64_t *count, int64_t *totalUs, int64_t *maxUs);
+
     /**
      * finish all pending works
      */
@@ -143,13 +193,23 @@ protected:
      *
      * \param[in]   frameIndex    the index of the pending work
      * \param[in]   fillWork      the function to fill the retrieved work.
+     * \param[out]  batch         if not null, the filled work is appended to
+     *                            |batch| instead of being returned, and is
+     *                            returned later by finishBatch().
      */
     void finish(uint64_t frameIndex,
-            std::function<void(const std::unique_ptr<C2Work> &)> fillWork);
+            C2RKFillWorkRef fillWork,
+            std::list<std::unique_ptr<C2Work>> *batch = nullptr);
 
     void finish(
             std::unique_ptr<C2Work> &work,
-            std::function<void(const std::unique_ptr<C2Work> &)> fillWork);
+            C2RKFillWorkRef fillWork,
+            std::list<std::unique_ptr<C2Work>> *batch = nullptr);
+
+    /**
+     * Return all works collected in |batch| to client with one listener call.
+     */
+    void finishBatch(std::list<std::unique_ptr<C2Work>> *batch);
     /**
      * Clone pending or current work and send the work back to client.
      *
@@ -159,13 +219,13 @@ protected:
      * returned to the client.
      *
      * \param[in]   frameIndex    the index of the work
-     * \param[in]   currentWork   the current work under processing
+     * \param[in]   currentWork   the current work under processing, or null
      * \param[in]   fillWork      the function to fill the retrieved work.
      */
     void cloneAndSend(
             uint64_t frameIndex,
             const std::unique_ptr<C2Work> &currentWork,
-            std::function<void(const std::unique_ptr<C2Work> &)> fillWork);
+            C2RKFillWorkRef fillWork);
 
 
     std::shared_ptr<C2Buffer> createLinearBuffer(
@@ -186,14 +246,10 @@ protected:
     C2ReadView mDummyReadView;
 
 private:
-    struct WorkInfo {
-        uint64_t frameIndex;
-        std::function<void(const std::unique_ptr<C2Work> &)> fillWork;
-    };
-
     const std::shared_ptr<C2ComponentInterface> mIntf;
 
-    std::list<WorkInfo> mReadyWork;
+    /* process the front work in queue, returns true if more work queued */
+    bool processWork();
 
     class WorkHandler : public AHandler {
     public:
@@ -225,21 +281,89 @@ private:
         RUNNING,
     };
 
+    /*
+     * Execution state and flushing flag packed in one word. It is only
+     * written with mExecState locked on the control path, so per-frame
+     * queries from component and output loopers can go without the lock.
+     */
+    enum : uint32_t {
+        kExecStateMask = 0x0f,
+        kExecFlushing  = 0x10,
+    };
+    std::atomic<uint32_t> mExecWord;
+
+    int getExecState() const {
+        return mExecWord.load(std::memory_order_acquire) & kExecStateMask;
+    }
+    void setExecState_l(int state);
+    void setFlushing_l(bool flushing);
+
+    /*
+     * Listener is replaced with mExecState locked on the control path, and
+     * loaded atomically for each returned work without the lock.
+     */
+    std::shared_ptr<C2Component::Listener> mListener;
+
+    std::shared_ptr<C2Component::Listener> getListener() const {
+        return std::atomic_load(&mListener);
+    }
+
     struct ExecState {
-        ExecState() : mState(UNINITIALIZED) , mFlushing(false) {}
+        ExecState() : mFetchStallCount(0), mFetchStallTotalUs(0), mFetchStallMaxUs(0) {}
 
-        int mState;
-        bool mFlushing;
-        std::shared_ptr<C2Component::Listener> mListener;
+        /* time of output block fetch blocked by the consumer */
+        int64_t mFetchStallCount;
+        int64_t mFetchStallTotalUs;
+        int64_t mFetchStallMaxUs;
     };
     Mutexed<ExecState> mExecState;
 
+    /* signalled when a work is queued as pending */
+    Condition mPendingCond;
+
+    /* signalled on flushing to wake up blocked block fetch */
+    Condition mFetchCond;
+
+    bool waitFetchBackoff(int64_t timeUs);
+    void recordFetchStall(int64_t stallUs);
+
     sp<ALooper> mLooper;
     sp<WorkHandler> mHandler;
 
+    /*
+     * Pending works sorted by frameIndex. Works are queued in ascending order
+     * mostly, so insertion is at the tail and removal is around the head.
+     * Lookup and counting is binary search.
+     */
+    class PendingWork {
+    public:
+        bool empty() const { return mEntries.empty(); }
+        size_t size() const { return mEntries.size(); }
+        void clear() { mEntries.clear(); }
+
+        bool contains(uint64_t frameIndex) const;
+        C2Work *peek(uint64_t frameIndex) const;
+        size_t countBefore(uint64_t frameIndex) const;
+
+        /* insert work, returns the replaced one with the same frameIndex */
+        std::unique_ptr<C2Work> put(uint64_t frameIndex, std::unique_ptr<C2Work> work);
+        /* remove work with frameIndex, returns nullptr if not found */
+        std::unique_ptr<C2Work> take(uint64_t frameIndex);
+        std::unique_ptr<C2Work> takeOldest();
+
+    private:
+        struct Entry {
+            uint64_t frameIndex;
+            std::unique_ptr<C2Work> work;
+        };
+
+        std::deque<Entry>::const_iterator lowerBound(uint64_t frameIndex) const;
+
+        std::deque<Entry> mEntries;
+    };
+
     class WorkQueue {
     public:
-        typedef std::unordered_map<uint64_t, std::unique_ptr<C2Work>> PendingWork;
 
         inline WorkQueue() : mFlush(false), mGeneration(0ul) {}
 
@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
+#include <sys/vfs.h>
 
 #include "C2RKDmaBufSync.h"
 
@@ -48,6 +49,8 @@ struct dma_buf_sync {
 #define DMA_BUF_BASE		    'b'
 #define DMA_BUF_IOCTL_SYNC	    _IOW(DMA_BUF_BASE, 0, struct dma_buf_sync)
 
+#define DMA_BUF_MAGIC           0x444d4142  /* "DMAB" */
+
 
 bool dma_sync_device_to_cpu(int fd) {
     struct dma_buf_sync sync = {0};
@@ -62,3 +65,12 @@ bool dma_sync_cpu_to_device(int fd) {
     sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
     return (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) >= 0) ? true : false;
 }
+
+bool dma_buf_check_fd(int fd) {
+    struct statfs fs;
+
+    if (fd < 0 || fstatfs(fd, &fs) < 0) {
+        return false;
+    }
+    return (fs.f_type == DMA_BUF_MAGIC) ? true : false;
+}
@@ -18,6 +18,9 @@
 #include "C2RKGraphicBufferMapper.h"
 #include "C2RKLogger.h"
 
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
 #include <hardware/hardware_rockchip.h>
 #include <hardware/gralloc.h>
 #include <android/hardware/graphics/mapper/4.0/IMapper.h>
@@ -26,6 +29,13 @@ namespace android {
 
 C2_LOGGER_ENABLE("C2RKGraphicBufferMapper");
 
+#ifndef DMA_BUF_MAGIC
+#define DMA_BUF_MAGIC   0x444d4142
+#endif
+
+/* idle buffers kept imported after their last release */
+constexpr size_t kMaxIdleBuffers = 4;
+
 using android::hardware::graphics::mapper::V4_0::Error;
 using android::hardware::graphics::mapper::V4_0::IMapper;
 using android::hardware::hidl_vec;
@@ -87,7 +97,9 @@ static status_t encodeRkOffsetOfVideoMetadata(
     return OK;
 }
 
-C2RKGraphicBufferMapper::C2RKGraphicBufferMapper() {
+C2RKGraphicBufferMapper::C2RKGraphicBufferMapper()
+    : mCacheHits(0),
+      mCacheMisses(0) {
     mMapperVersion = GraphicBufferMapper::get().getMapperVersion();
     Log.I("init with mapper version %d", mMapperVersion);
 }
@@ -305,6 +317,128 @@ status_t C2RKGraphicBufferMapper::freeBuffer(buffer_handle_t handle) {
     return OK;
 }
 
+/*
+ * dmabuf has its own inode since kernel 5.3, older kernels share one anon
+ * inode for all dmabufs, which can not tell buffers apart.
+ */
+static bool getDmaBufInode(int32_t fd, struct stat *st) {
+    struct statfs fs;
+
+    if (fstatfs(fd, &fs) != 0 || fs.f_type != DMA_BUF_MAGIC) {
+        return false;
+    }
+    return (fstat(fd, st) == 0);
+}
+
+status_t C2RKGraphicBufferMapper::acquireBuffer(
+        const C2Handle *const c2Handle, BufferInfo *info) {
+    struct stat st;
+    ino_t inode = 0;
+    dev_t dev = 0;
+
+    if (c2Handle->numFds > 0 && getDmaBufInode(c2Handle->data[0], &st)) {
+        inode = st.st_ino;
+        dev = st.st_dev;
+    }
+
+    Mutex::Autolock autoLock(mCacheLock);
+
+    if (inode != 0) {
+        auto it = mInodeIndex.find(inode);
+        if (it != mInodeIndex.end()) {
+            CacheEntry &entry = mCache.at(it->second);
+            // the cached handle keeps the dmabuf alive, so its inode is not reused
+            if (entry.dev == dev) {
+                refEntry(&entry);
+                mCacheHits++;
+                *info = entry.info;
+                return OK;
+            }
+        }
+    }
+
+    mCacheMisses++;
+
+    buffer_handle_t handle = nullptr;
+    status_t err = importBuffer(c2Handle, &handle);
+    if (err != OK) {
+        return err;
+    }
+
+    uint64_t bufferId = getBufferId(handle);
+
+    auto it = mCache.find(bufferId);
+    if (it != mCache.end()) {
+        // already cached but not indexed by inode
+        std::ignore = freeBuffer(handle);
+        refEntry(&it->second);
+        *info = it->second.info;
+        return OK;
+    }
+
+    CacheEntry entry {
+        .info = {
+            .handle         = handle,
+            .bufferId       = bufferId,
+            .allocationSize = getAllocationSize(handle),
+            .pixelStride    = getPixelStride(handle),
+            .byteStride     = getByteStride(handle),
+            .usage          = getUsage(handle),
+        },
+        .inode    = inode,
+        .dev      = dev,
+        .refCount = 1,
+    };
+
+    std::ignore = mCache.emplace(bufferId, entry);
+    if (inode != 0) {
+        mInodeIndex[inode] = bufferId;
+    }
+
+    *info = entry.info;
+    return OK;
+}
+
+void C2RKGraphicBufferMapper::releaseBuffer(const BufferInfo &info) {
+    Mutex::Autolock autoLock(mCacheLock);
+
+    auto it = mCache.find(info.bufferId);
+    if (it == mCache.end() || it->second.info.handle != info.handle) {
+        Log.W("release unknown buffer, id %lld", (long long)info.bufferId);
+        return;
+    }
+
+    if (--it->second.refCount > 0) {
+        return;
+    }
+
+    // keep a few idle buffers for transient users, such as a surface probe
+    mIdleList.push_front(info.bufferId);
+
+    while (mIdleList.size() > kMaxIdleBuffers) {
+        auto victim = mCache.find(mIdleList.back());
+        mIdleList.pop_back();
+
+        std::ignore = freeBuffer(victim->second.info.handle);
+        if (victim->second.inode != 0) {
+            std::ignore = mInodeIndex.erase(victim->second.inode);
+        }
+        std::ignore = mCache.erase(victim);
+    }
+}
+
+void C2RKGraphicBufferMapper::refEntry(CacheEntry *entry) {
+    if (entry->refCount++ == 0) {
+        mIdleList.remove(entry->info.bufferId);
+    }
+}
+
+void C2RKGraphicBufferMapper::getCacheStats(int64_t *hits, int64_t *misses) {
+    Mutex::Autolock autoLock(mCacheLock);
+    *hits = mCacheHits;
+    *misses = mCacheMisses;
+}
+
 int32_t C2RKGraphicBufferMapper::setDynamicHdrMeta(buffer_handle_t handle, int64_t offset) {
     int err = 0;
 
@@ -18,10 +18,18 @@
 #include <cutils/properties.h>
 #include <C2Config.h>
 
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #include "C2RKMediaUtils.h"
 #include "C2RKDmaBufSync.h"
 #include "C2RKChipCapDef.h"
 #include "C2RKLogger.h"
+#include "C2RKPropsDef.h"
+#include "C2RKThreadPool.h"
 
 namespace android {
 
@@ -228,16 +236,18 @@ uint64_t C2RKMediaUtils::getHStrideUsage(int32_t height, int32_t hstride) {
 #endif
 }
 
+static const int32_t gIepDefRefCount = 5;
+
+static const int32_t g264MinRefCount = 4;
+static const int32_t g265MinRefCount = 6;
+static const int32_t gVP9MinRefCount = 5;
+
 uint32_t C2RKMediaUtils::calculateVideoRefCount(
         MppCodingType type, int32_t width, int32_t height, int32_t level) {
-    static const int32_t g264MinRefCount = 4;
     static const int32_t g264MaxRefCount = 16;
-    static const int32_t g265MinRefCount = 6;
     static const int32_t g265MaxRefCount = 16;
-    static const int32_t gVP9MinRefCount = 5;
     static const int32_t gVP9MaxRefCount = 16;
     static const int32_t gAV1DefRefCount = 10;
-    static const int32_t gIepDefRefCount = 5;
 
     uint32_t maxDpbPixs = 0;
     uint32_t refCount = 0;
@@ -292,6 +302,34 @@ uint32_t C2RKMediaUtils::calculateVideoRefCount(
     return refCount;
 }
 
+uint32_t C2RKMediaUtils::calculateStreamRefCount(
+        MppCodingType type, int32_t width, int32_t height, int32_t maxDecBuffering) {
+    // one more slot for the picture being decoded
+    uint32_t refCount = maxDecBuffering + 1;
+
+    // keep the same floor as level based count, too few slots starve decoder
+    switch (type) {
+      case MPP_VIDEO_CodingAVC:
+        refCount = C2_MAX(refCount, (uint32_t)g264MinRefCount);
+        break;
+      case MPP_VIDEO_CodingHEVC:
+        refCount = C2_MAX(refCount, (uint32_t)g265MinRefCount);
+        break;
+      case MPP_VIDEO_CodingVP9:
+        refCount = C2_MAX(refCount, (uint32_t)gVP9MinRefCount);
+        break;
+      default:
+        break;
+    }
+
+    if (type == MPP_VIDEO_CodingAVC && (width <= 1920 || height <= 1920)) {
+        // reserved for deinterlace
+        refCount += gIepDefRefCount;
+    }
+
+    return refCount;
+}
+
 bool C2RKMediaUtils::isP010Allowed() {
     // The first SDK the device shipped with.
     int32_t productFirstApiLevel = property_get_int32("ro.product.first_api_level", 0);
@@ -345,14 +383,231 @@ void C2RKMediaUtils::translateToRequestFmt(
     }
 }
 
-void C2RKMediaUtils::convert10BitNV12ToP010(
-        C2FrameInfo srcInfo, C2FrameInfo dstInfo, bool cacheSync) {
-    uint32_t i, k;
-    uint8_t *srcY  = srcInfo.ptr;
+/*
+ * 10-bit compact unpack kernels.
+ *
+ * Every 10 bytes of source hold 8 pixels packed as a little-endian bit
+ * stream, pixel j lives at bit (10 * j). The scalar kernel is the reference,
+ * SIMD kernels build 16-bit lanes with a byte shuffle, then align each
+ * 10-bit field to bit 6 with a per-lane multiply/shift, which is exactly the
+ * P010 sample. 8-bit output takes the high byte of it.
+ */
+typedef void (*C2UnpackRowFunc)(const uint8_t *src, uint8_t *dst, int32_t groups);
+
+typedef struct {
+    const char      *name;
+    C2UnpackRowFunc  toP010;
+    C2UnpackRowFunc  toNV12;
+} C2UnpackKernels;
+
+static void unpackRowToP010_C(const uint8_t *src, uint8_t *dst, int32_t groups) {
+    for (int32_t k = 0; k < groups; k++) {
+        uint16_t *pix = (uint16_t *)(dst + k * 16);
+        uint16_t *baseU16 = (uint16_t *)(src + k * 10);
+
+        pix[0] =  (baseU16[0] & 0x03FF) << 6;
+        pix[1] = ((baseU16[0] & 0xFC00) >> 10 | (baseU16[1] & 0x000F) << 6) << 6;
+        pix[2] = ((baseU16[1] & 0x3FF0) >> 4) << 6;
+        pix[3] = ((baseU16[1] & 0xC000) >> 14 | (baseU16[2] & 0x00FF) << 2) << 6;
+        pix[4] = ((baseU16[2] & 0xFF00) >> 8  | (baseU16[3] & 0x0003) << 8) << 6;
+        pix[5] = ((baseU16[3] & 0x0FFC) >> 2) << 6;
+        pix[6] = ((baseU16[3] & 0xF000) >> 12 | (baseU16[4] & 0x003F) << 4) << 6;
+        pix[7] = ((baseU16[4] & 0xFFC0) >> 6) << 6;
+    }
+}
+
+static void unpackRowToNV12_C(const uint8_t *src, uint8_t *dst, int32_t groups) {
+    for (int32_t k = 0; k < groups; k++) {
+        uint8_t *pix = (uint8_t *)(dst + k * 8);
+        uint16_t *baseU16 = (uint16_t *)(src + k * 10);
+
+        pix[0] = (uint8_t)((baseU16[0] & 0x03FF) >> 2);
+        pix[1] = (uint8_t)(((baseU16[0] & 0xFC00) >> 10
+            | (baseU16[1] & 0x000F) << 6) >> 2);
+        pix[2] = (uint8_t)(((baseU16[1] & 0x3FF0) >> 4) >> 2);
+        pix[3] = (uint8_t)(((baseU16[1] & 0xC000) >> 14
+            | (baseU16[2] & 0x00FF) << 2) >> 2);
+        pix[4] = (uint8_t)(((baseU16[2] & 0xFF00) >> 8
+            | (baseU16[3] & 0x0003) << 8) >> 2);
+        pix[5] = (uint8_t)(((baseU16[3] & 0x0FFC) >> 2) >> 2);
+        pix[6] = (uint8_t)(((baseU16[3] & 0xF000) >> 12
+            | (baseU16[4] & 0x003F) << 4) >> 2);
+        pix[7] = (uint8_t)(((baseU16[4] & 0xFFC0) >> 6) >> 2);
+    }
+}
+
+/*
+ * SIMD kernels load 16 bytes per 10-byte group, so the last groups of a row
+ * are left to the scalar kernel to never read beyond what it reads.
+ */
+#if defined(__aarch64__)
+
+static const uint8_t kUnpackShuffle[16] = {
+    0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9
+};
+static const int16_t kUnpackShift[8] = { 6, 4, 2, 0, 6, 4, 2, 0 };
+
+static inline uint16x8_t unpackGroup_NEON(
+        const uint8_t *src, uint8x16_t shuffle, int16x8_t shift, uint16x8_t mask) {
+    uint8x16_t bytes = vqtbl1q_u8(vld1q_u8(src), shuffle);
+    return vandq_u16(vshlq_u16(vreinterpretq_u16_u8(bytes), shift), mask);
+}
+
+static void unpackRowToP010_NEON(const uint8_t *src, uint8_t *dst, int32_t groups) {
+    uint8x16_t shuffle = vld1q_u8(kUnpackShuffle);
+    int16x8_t shift = vld1q_s16(kUnpackShift);
+    uint16x8_t mask = vdupq_n_u16(0xFFC0);
+    int32_t k = 0;
+
+    for (; k + 2 <= groups; k++) {
+        vst1q_u16((uint16_t *)(dst + k * 16),
+                  unpackGroup_NEON(src + k * 10, shuffle, shift, mask));
+    }
+    unpackRowToP010_C(src + k * 10, dst + k * 16, groups - k);
+}
+
+static void unpackRowToNV12_NEON(const uint8_t *src, uint8_t *dst, int32_t groups) {
+    uint8x16_t shuffle = vld1q_u8(kUnpackShuffle);
+    int16x8_t shift = vld1q_s16(kUnpackShift);
+    uint16x8_t mask = vdupq_n_u16(0xFFC0);
+    int32_t k = 0;
+
+    for (; k + 2 <= groups; k++) {
+        vst1_u8(dst + k * 8,
+                vshrn_n_u16(unpackGroup_NEON(src + k * 10, shuffle, shift, mask), 8));
+    }
+    unpackRowToNV12_C(src + k * 10, dst + k * 8, groups - k);
+}
+
+#elif defined(__x86_64__) || defined(__i386__)
+
+#define C2_UNPACK_SHUFFLE   0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9
+#define C2_UNPACK_MULTIPLY  64, 16, 4, 1, 64, 16, 4, 1
+
+__attribute__((target("ssse3")))
+static inline __m128i unpackGroup_SSSE3(const uint8_t *src) {
+    const __m128i shuffle = _mm_setr_epi8(C2_UNPACK_SHUFFLE);
+    const __m128i multiply = _mm_setr_epi16(C2_UNPACK_MULTIPLY);
+    const __m128i mask = _mm_set1_epi16((int16_t)0xFFC0);
+
+    __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), shuffle);
+    return _mm_and_si128(_mm_mullo_epi16(v, multiply), mask);
+}
+
+__attribute__((target("ssse3")))
+static void unpackRowToP010_SSSE3(const uint8_t *src, uint8_t *dst, int32_t groups) {
+    int32_t k = 0;
+
+    for (; k + 2 <= groups; k++) {
+        _mm_storeu_si128((__m128i *)(dst + k * 16), unpackGroup_SSSE3(src + k * 10));
+    }
+    unpackRowToP010_C(src + k * 10, dst + k * 16, groups - k);
+}
+
+__attribute__((target("ssse3")))
+static void unpackRowToNV12_SSSE3(const uint8_t *src, uint8_t *dst, int32_t groups) {
+    int32_t k = 0;
+
+    for (; k + 2 <= groups; k++) {
+        __m128i v = _mm_srli_epi16(unpackGroup_SSSE3(src + k * 10), 8);
+        _mm_storel_epi64((__m128i *)(dst + k * 8), _mm_packus_epi16(v, v));
+    }
+    unpackRowToNV12_C(src + k * 10, dst + k * 8, groups - k);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i unpackGroups_AVX2(const uint8_t *src) {
+    const __m256i shuffle = _mm256_setr_epi8(C2_UNPACK_SHUFFLE, C2_UNPACK_SHUFFLE);
+    const __m256i multiply = _mm256_setr_epi16(C2_UNPACK_MULTIPLY, C2_UNPACK_MULTIPLY);
+    const __m256i mask = _mm256_set1_epi16((int16_t)0xFFC0);
+
+    // two groups, one per 128-bit lane
+    __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)src)),
+            _mm_loadu_si128((const __m128i *)(src + 10)), 1);
+    v = _mm256_shuffle_epi8(v, shuffle);
+    return _mm256_and_si256(_mm256_mullo_epi16(v, multiply), mask);
+}
+
+__attribute__((target("avx2")))
+static void unpackRowToP010_AVX2(const uint8_t *src, uint8_t *dst, int32_t groups) {
+    int32_t k = 0;
+
+    for (; k + 3 <= groups; k += 2) {
+        _mm256_storeu_si256((__m256i *)(dst + k * 16), unpackGroups_AVX2(src + k * 10));
+    }
+    unpackRowToP010_SSSE3(src + k * 10, dst + k * 16, groups - k);
+}
+
+__attribute__((target("avx2")))
+static void unpackRowToNV12_AVX2(const uint8_t *src, uint8_t *dst, int32_t groups) {
+    int32_t k = 0;
+
+    for (; k + 3 <= groups; k += 2) {
+        __m256i v = _mm256_srli_epi16(unpackGroups_AVX2(src + k * 10), 8);
+        __m128i p = _mm_packus_epi16(
+                _mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        _mm_storeu_si128((__m128i *)(dst + k * 8), p);
+    }
+    unpackRowToNV12_SSSE3(src + k * 10, dst + k * 8, groups - k);
+}
+
+#endif
+
+static C2UnpackKernels selectUnpackKernels() {
+    C2UnpackKernels kernels = { "c", unpackRowToP010_C, unpackRowToNV12_C };
+
+    if (property_get_int32("codec2_disable_simd", 0)) {
+        return kernels;
+    }
+
+#if defined(__aarch64__)
+    kernels = { "neon", unpackRowToP010_NEON, unpackRowToNV12_NEON };
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels = { "avx2", unpackRowToP010_AVX2, unpackRowToNV12_AVX2 };
+    } else if (__builtin_cpu_supports("ssse3")) {
+        kernels = { "ssse3", unpackRowToP010_SSSE3, unpackRowToNV12_SSSE3 };
+    }
+#endif
+
+    Log.I("use %s 10bit unpack kernels", kernels.name);
+    return kernels;
+}
+
+static const C2UnpackKernels& getUnpackKernels() {
+    static const C2UnpackKernels sKernels = selectUnpackKernels();
+    return sKernels;
+}
+
+/*
+ * Run rowFunc over all Y and UV rows of a NV12 layout frame. Rows are split
+ * into bands and converted on the shared thread pool, joined before return.
+ */
+static void convertPlaneRows(
+        const C2FrameInfo &srcInfo, const C2FrameInfo &dstInfo,
+        const std::function<void(const uint8_t *src, uint8_t *dst)> &rowFunc) {
     uint8_t *srcUV = (uint8_t*)(srcInfo.ptr + srcInfo.hstride * srcInfo.vstride);
-    uint8_t *dstY  = dstInfo.ptr;
     uint8_t *dstUV = (uint8_t*)(dstInfo.ptr + dstInfo.hstride * dstInfo.vstride);
+    int32_t rows = srcInfo.height + srcInfo.height / 2;
+
+    C2RKThreadPool::get()->parallelFor(
+            rows, C2RKPropsDef::getSwConvertBandRows(), [&](int32_t begin, int32_t end) {
+        for (int32_t row = begin; row < end; row++) {
+            if (row < srcInfo.height) {
+                rowFunc(srcInfo.ptr + row * srcInfo.hstride,
+                        dstInfo.ptr + row * dstInfo.hstride);
+            } else {
+                int32_t uvRow = row - srcInfo.height;
+                rowFunc(srcUV + uvRow * srcInfo.hstride, dstUV + uvRow * dstInfo.hstride);
+            }
+        }
+    });
+}
 
+void C2RKMediaUtils::convert10BitNV12ToP010(
+        C2FrameInfo srcInfo, C2FrameInfo dstInfo, bool cacheSync) {
     dumpFrameInfo(srcInfo, "src");
     dumpFrameInfo(dstInfo, "dst");
 
@@ -360,36 +615,12 @@ void C2RKMediaUtils::convert10BitNV12ToP010(
         std::ignore = dma_sync_device_to_cpu(srcInfo.fd);
     }
 
-    for (i = 0; i < srcInfo.height; i++, srcY += srcInfo.hstride, dstY += dstInfo.hstride) {
-        for (k = 0; k < (srcInfo.width + 7) / 8; k++) {
-            uint16_t *pix = (uint16_t *)(dstY + k * 16);
-            uint16_t *baseU16 = (uint16_t *)(srcY + k * 10);
-
-            pix[0] =  (baseU16[0] & 0x03FF) << 6;
-            pix[1] = ((baseU16[0] & 0xFC00) >> 10 | (baseU16[1] & 0x000F) << 6) << 6;
-            pix[2] = ((baseU16[1] & 0x3FF0) >> 4) << 6;
-            pix[3] = ((baseU16[1] & 0xC000) >> 14 | (baseU16[2] & 0x00FF) << 2) << 6;
-            pix[4] = ((baseU16[2] & 0xFF00) >> 8  | (baseU16[3] & 0x0003) << 8) << 6;
-            pix[5] = ((baseU16[3] & 0x0FFC) >> 2) << 6;
-            pix[6] = ((baseU16[3] & 0xF000) >> 12 | (baseU16[4] & 0x003F) << 4) << 6;
-            pix[7] = ((baseU16[4] & 0xFFC0) >> 6) << 6;
-        }
-    }
-    for (i = 0; i < srcInfo.height / 2; i++, srcUV += srcInfo.hstride, dstUV += dstInfo.hstride) {
-        for (k = 0; k < (srcInfo.width + 7) / 8; k++) {
-            uint16_t *pix = (uint16_t *)(dstUV + k * 16);
-            uint16_t *baseU16 = (uint16_t *)(srcUV + k * 10);
-
-            pix[0] =  (baseU16[0] & 0x03FF) << 6;
-            pix[1] = ((baseU16[0] & 0xFC00) >> 10 | (baseU16[1] & 0x000F) << 6) << 6;
-            pix[2] = ((baseU16[1] & 0x3FF0) >> 4) << 6;
-            pix[3] = ((baseU16[1] & 0xC000) >> 14 | (baseU16[2] & 0x00FF) << 2) << 6;
-            pix[4] = ((baseU16[2] & 0xFF00) >> 8  | (baseU16[3] & 0x0003) << 8) << 6;
-            pix[5] = ((baseU16[3] & 0x0FFC) >> 2) << 6;
-            pix[6] = ((baseU16[3] & 0xF000) >> 12 | (baseU16[4] & 0x003F) << 4) << 6;
-            pix[7] = ((baseU16[4] & 0xFFC0) >> 6) << 6;
-        }
-    }
+    C2UnpackRowFunc unpackRow = getUnpackKernels().toP010;
+    int32_t groups = (srcInfo.width + 7) / 8;
+
+    convertPlaneRows(srcInfo, dstInfo, [&](const uint8_t *src, uint8_t *dst) {
+        unpackRow(src, dst, groups);
+    });
 
     if (cacheSync && dstInfo.fd > 0) {
         // invalid CPU cache
@@ -399,12 +630,6 @@ void C2RKMediaUtils::convert10BitNV12ToP010(
 
 void C2RKMediaUtils::convert10BitNV12ToNV12(
         C2FrameInfo srcInfo, C2FrameInfo dstInfo, bool cacheSync) {
-    uint32_t i, k;
-    uint8_t *srcY  = srcInfo.ptr;
-    uint8_t *srcUV = (uint8_t*)(srcInfo.ptr + srcInfo.hstride * srcInfo.vstride);
-    uint8_t *dstY  = dstInfo.ptr;
-    uint8_t *dstUV = (uint8_t*)(dstInfo.ptr + dstInfo.hstride * dstInfo.vstride);
-
     dumpFrameInfo(srcInfo, "src");
     dumpFrameInfo(dstInfo, "dst");
 
@@ -412,44 +637,12 @@ void C2RKMediaUtils::convert10BitNV12ToNV12(
         std::ignore = dma_sync_device_to_cpu(srcInfo.fd);
     }
 
-    for (i = 0; i < srcInfo.height; i++, srcY += srcInfo.hstride, dstY += dstInfo.hstride) {
-        for (k = 0; k < (srcInfo.width + 7) / 8; k++) {
-            uint8_t *pix = (uint8_t *)(dstY + k * 8);
-            uint16_t *baseU16 = (uint16_t *)(srcY + k * 10);
-
-            pix[0] = (uint8_t)((baseU16[0] & 0x03FF) >> 2);
-            pix[1] = (uint8_t)(((baseU16[0] & 0xFC00) >> 10
-                | (baseU16[1] & 0x000F) << 6) >> 2);
-            pix[2] = (uint8_t)(((baseU16[1] & 0x3FF0) >> 4) >> 2);
-            pix[3] = (uint8_t)(((baseU16[1] & 0xC000) >> 14
-                | (baseU16[2] & 0x00FF) << 2) >> 2);
-            pix[4] = (uint8_t)(((baseU16[2] & 0xFF00) >> 8
-                | (baseU16[3] & 0x0003) << 8) >> 2);
-            pix[5] = (uint8_t)(((baseU16[3] & 0x0FFC) >> 2) >> 2);
-            pix[6] = (uint8_t)(((baseU16[3] & 0xF000) >> 12
-                | (baseU16[4] & 0x003F) << 4) >> 2);
-            pix[7] = (uint8_t)(((baseU16[4] & 0xFFC0) >> 6) >> 2);
-        }
-    }
-    for (i = 0; i < srcInfo.height / 2; i++, srcUV += srcInfo.hstride, dstUV += dstInfo.hstride) {
-        for (k = 0; k < (srcInfo.width + 7) / 8; k++) {
-            uint8_t *pix = (uint8_t *)(dstUV + k * 8);
-            uint16_t *baseU16 = (uint16_t *)(srcUV + k * 10);
-
-            pix[0] = (uint8_t)((baseU16[0] & 0x03FF) >> 2);
-            pix[1] = (uint8_t)(((baseU16[0] & 0xFC00) >> 10
-                | (baseU16[1] & 0x000F) << 6) >> 2);
-            pix[2] = (uint8_t)(((baseU16[1] & 0x3FF0) >> 4) >> 2);
-            pix[3] = (uint8_t)(((baseU16[1] & 0xC000) >> 14
-                | (baseU16[2] & 0x00FF) << 2) >> 2);
-            pix[4] = (uint8_t)(((baseU16[2] & 0xFF00) >> 8
-                | (baseU16[3] & 0x0003) << 8) >> 2);
-            pix[5] = (uint8_t)(((baseU16[3] & 0x0FFC) >> 2) >> 2);
-            pix[6] = (uint8_t)(((baseU16[3] & 0xF000) >> 12
-                | (baseU16[4] & 0x003F) << 4) >> 2);
-            pix[7] = (uint8_t)(((baseU16[4] & 0xFFC0) >> 6) >> 2);
-        }
-    }
+    C2UnpackRowFunc unpackRow = getUnpackKernels().toNV12;
+    int32_t groups = (srcInfo.width + 7) / 8;
+
+    convertPlaneRows(srcInfo, dstInfo, [&](const uint8_t *src, uint8_t *dst) {
+        unpackRow(src, dst, groups);
+    });
 
     if (cacheSync && dstInfo.fd > 0) {
         // invalid CPU cache
@@ -459,9 +652,6 @@ void C2RKMediaUtils::convert10BitNV12ToNV12(
 
 void C2RKMediaUtils::convertNV12ToNV12(
         C2FrameInfo srcInfo, C2FrameInfo dstInfo, bool cacheSync) {
-    uint8_t *srcUV = (uint8_t*)(srcInfo.ptr + srcInfo.hstride * srcInfo.vstride);
-    uint8_t *dstUV = (uint8_t*)(dstInfo.ptr + dstInfo.hstride * dstInfo.vstride);
-
     dumpFrameInfo(srcInfo, "src");
     dumpFrameInfo(dstInfo, "dst");
 
@@ -469,16 +659,9 @@ void C2RKMediaUtils::convertNV12ToNV12(
         std::ignore = dma_sync_device_to_cpu(srcInfo.fd);
     }
 
-    for (int i = 0; i < srcInfo.height; i++) {
-        std::ignore = memcpy(dstInfo.ptr, srcInfo.ptr, srcInfo.width);
-        srcInfo.ptr += srcInfo.hstride;
-        dstInfo.ptr += dstInfo.hstride;
-    }
-    for (int i = 0; i < srcInfo.height / 2; i++) {
-        std::ignore = memcpy(dstUV, srcUV, srcInfo.width);
-        srcUV += srcInfo.hstride;
-        dstUV += dstInfo.hstride;
-    }
+    convertPlaneRows(srcInfo, dstInfo, [&](const uint8_t *src, uint8_t *dst) {
+        std::ignore = memcpy(dst, src, srcInfo.width);
+    });
 
     if (cacheSync && dstInfo.fd > 0) {
         // invalid CPU cache
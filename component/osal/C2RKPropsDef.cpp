@@ -24,6 +24,14 @@ static int32_t sScaleDisable = 0;
 static int32_t sLowMemoryMode= 0;
 static int32_t sInputBufferSize = 0;
 static int32_t sEncAsyncOutputMode = 0;
+static int32_t sEncZeroCopyOutput = 0;
+static int32_t sEncSliceOutput = 0;
+static int32_t sDecOutputBatchSize = 0;
+static int32_t sDecOutputBatchLatencyUs = 0;
+static int32_t sDecZeroCopyInput = 0;
+static int32_t sSwConvertBandRows = 0;
+static int32_t sDecWarmContextNum = 0;
+static int32_t sDecSoftStop = 0;
 static bool sPropInited = propInit();
 
 static bool propInit() {
@@ -39,6 +47,22 @@ static bool propInit() {
 
     sEncAsyncOutputMode = property_get_int32("codec2_enc_async_output_mode", 0);
 
+    sEncZeroCopyOutput = property_get_int32("codec2_enc_zero_copy_output", 1);
+
+    sEncSliceOutput = property_get_int32("codec2_enc_slice_output", 0);
+
+    sDecOutputBatchSize = property_get_int32("codec2_dec_output_batch_size", 8);
+
+    sDecOutputBatchLatencyUs = property_get_int32("codec2_dec_output_batch_latency_us", 5000);
+
+    sDecZeroCopyInput = property_get_int32("codec2_dec_zero_copy_input", 1);
+
+    sSwConvertBandRows = property_get_int32("codec2_sw_convert_band_rows", 64);
+
+    sDecWarmContextNum = property_get_int32("codec2_dec_warm_ctx_num", 2);
+
+    sDecSoftStop = property_get_int32("codec2_dec_soft_stop", 1);
+
     return true;
 }
 
@@ -65,3 +89,35 @@ int32_t C2RKPropsDef::getInputBufferSize() {
 int32_t C2RKPropsDef::getEncAsyncOutputMode() {
     return sEncAsyncOutputMode;
 }
+
+int32_t C2RKPropsDef::getEncZeroCopyOutput() {
+    return sEncZeroCopyOutput;
+}
+
+int32_t C2RKPropsDef::getEncSliceOutput() {
+    return sEncSliceOutput;
+}
+
+int32_t C2RKPropsDef::getDecOutputBatchSize() {
+    return sDecOutputBatchSize;
+}
+
+int32_t C2RKPropsDef::getDecOutputBatchLatencyUs() {
+    return sDecOutputBatchLatencyUs;
+}
+
+int32_t C2RKPropsDef::getDecZeroCopyInput() {
+    return sDecZeroCopyInput;
+}
+
+int32_t C2RKPropsDef::getSwConvertBandRows() {
+    return sSwConvertBandRows;
+}
+
+int32_t C2RKPropsDef::getDecWarmContextNum() {
+    return sDecWarmContextNum;
+}
+
+int32_t C2RKPropsDef::getDecSoftStop() {
+    return sDecSoftStop;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2025 Rockchip Electronics Co. LTD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+
+#include "C2RKThreadPool.h"
+#include "C2RKMediaUtils.h"
+#include "C2RKLogger.h"
+
+namespace android {
+
+C2_LOGGER_ENABLE("C2RKThreadPool");
+
+// the calling thread always works on its own job too
+constexpr uint32_t kMaxPoolWorkers = 3;
+
+C2RKThreadPool::C2RKThreadPool()
+    : mStopped(false) {
+    uint32_t cpus = std::thread::hardware_concurrency();
+    uint32_t workers = C2_MIN(kMaxPoolWorkers, (cpus > 1) ? (cpus - 1) : 0);
+
+    for (uint32_t i = 0; i < workers; i++) {
+        mWorkers.emplace_back([this]() {
+            pthread_setname_np(pthread_self(), "C2PoolWorker");
+            workerLoop();
+        });
+    }
+
+    Log.I("start with %zu workers", mWorkers.size());
+}
+
+C2RKThreadPool::~C2RKThreadPool() {
+    {
+        Mutex::Autolock autoLock(mLock);
+        mStopped = true;
+        mJobCond.broadcast();
+    }
+
+    for (std::thread &worker : mWorkers) {
+        worker.join();
+    }
+}
+
+int32_t C2RKThreadPool::runBands(Job *job) {
+    int32_t done = 0;
+
+    while (true) {
+        int32_t band = job->nextBand.fetch_add(1);
+        if (band >= job->numBands) {
+            break;
+        }
+
+        int32_t begin = band * job->bandSize;
+        int32_t end = C2_MIN(begin + job->bandSize, job->count);
+
+        (*job->func)(begin, end);
+        done++;
+    }
+
+    return done;
+}
+
+void C2RKThreadPool::workerLoop() {
+    Mutex::Autolock autoLock(mLock);
+
+    while (!mStopped) {
+        if (mJobs.empty()) {
+            mJobCond.wait(mLock);
+            continue;
+        }
+
+        Job *job = mJobs.front();
+        if (job->nextBand.load() >= job->numBands) {
+            // all bands taken, nothing left to share
+            mJobs.pop_front();
+            continue;
+        }
+
+        job->users++;
+        mLock.unlock();
+
+        int32_t done = runBands(job);
+
+        mLock.lock();
+        job->pendingBands -= done;
+        job->users--;
+        if (job->pendingBands == 0 && job->users == 0) {
+            mDoneCond.broadcast();
+        }
+    }
+}
+
+void C2RKThreadPool::parallelFor(int32_t count, int32_t bandSize, const RangeFunc &func) {
+    if (count <= 0) {
+        return;
+    }
+
+    bandSize = C2_MAX(bandSize, 1);
+
+    int32_t numBands = (count + bandSize - 1) / bandSize;
+    if (numBands == 1 || mWorkers.empty()) {
+        func(0, count);
+        return;
+    }
+
+    Job job;
+    job.func = &func;
+    job.count = count;
+    job.bandSize = bandSize;
+    job.numBands = numBands;
+    job.nextBand = 0;
+    job.pendingBands = numBands;
+    job.users = 0;
+
+    {
+        Mutex::Autolock autoLock(mLock);
+        mJobs.push_back(&job);
+        mJobCond.broadcast();
+    }
+
+    int32_t done = runBands(&job);
+
+    Mutex::Autolock autoLock(mLock);
+    job.pendingBands -= done;
+    mJobs.remove(&job);
+
+    // wait for bands still running on workers
+    while (job.pendingBands > 0 || job.users > 0) {
+        mDoneCond.wait(mLock);
+    }
+}
+
+} // namespace android
@@ -20,5 +20,6 @@
 
 bool dma_sync_device_to_cpu(int fd);
 bool dma_sync_cpu_to_device(int fd);
+bool dma_buf_check_fd(int fd);
 
 #endif // #ifndef ANDROID_RK_C2_DMA_SYNC_H_
@@ -19,8 +19,12 @@
 #define ANDROID_C2_RK_GRAPHIC_BUFFER_MAPPER_H__
 
 #include <stdint.h>
+#include <list>
+#include <map>
+#include <sys/types.h>
 #include <cutils/native_handle.h>
 #include <utils/Errors.h>
+#include <utils/Mutex.h>
 
 #include <C2AllocatorGralloc.h>
 #include <ui/GraphicBufferMapper.h>
@@ -63,6 +67,16 @@ typedef struct rkvdec_scaling_metadata_t {
 
 class C2RKGraphicBufferMapper {
 public:
+    /* imported handle with immutable metadata of the buffer */
+    struct BufferInfo {
+        buffer_handle_t handle;
+        uint64_t bufferId;
+        int32_t  allocationSize;
+        int32_t  pixelStride;
+        int32_t  byteStride;
+        uint64_t usage;
+    };
+
     static C2RKGraphicBufferMapper* get() {
         static C2RKGraphicBufferMapper _gInstance;
         return &_gInstance;
@@ -84,6 +98,13 @@ public:
     status_t importBuffer(const C2Handle *const c2Handle, buffer_handle_t *outHandle);
     status_t freeBuffer(buffer_handle_t handle);
 
+    // Refcounted import cache keyed by buffer id, each acquireBuffer must be
+    // paired with releaseBuffer. The buffer is imported and queried once, and
+    // kept in a small idle list after the last reference is released.
+    status_t acquireBuffer(const C2Handle *const c2Handle, BufferInfo *info);
+    void     releaseBuffer(const BufferInfo &info);
+    void     getCacheStats(int64_t *hits, int64_t *misses);
+
     /* rk mapper metadata */
     int32_t  setDynamicHdrMeta(buffer_handle_t handle, int64_t offset);
     int64_t  getDynamicHdrMeta(buffer_handle_t handle);
@@ -94,7 +115,26 @@ private:
     C2RKGraphicBufferMapper();
     virtual ~C2RKGraphicBufferMapper() {};
 
+    struct CacheEntry {
+        BufferInfo info;
+        ino_t      inode;
+        dev_t      dev;
+        int32_t    refCount;
+    };
+
+    void refEntry(CacheEntry *entry);
+
     int32_t mMapperVersion;
+
+    Mutex   mCacheLock;
+    std::map<uint64_t, CacheEntry> mCache;
+    // dmabuf inode -> buffer id, find cached buffer without mapper import.
+    // only filled on kernels where each dmabuf has its own inode.
+    std::map<ino_t, uint64_t> mInodeIndex;
+    // buffer ids without reference, most recently released first
+    std::list<uint64_t> mIdleList;
+    int64_t mCacheHits;
+    int64_t mCacheMisses;
 };
 
 } // namepsace android
@@ -89,6 +89,10 @@ public:
     static uint32_t calculateVideoRefCount(
                 MppCodingType type, int32_t width, int32_t height, int32_t level);
 
+    // calculate video refCount on the basis of dpb buffering declared in stream
+    static uint32_t calculateStreamRefCount(
+                MppCodingType type, int32_t width, int32_t height, int32_t maxDecBuffering);
+
     // HAL_PIXEL_FORMAT_YCBCR_P010 requirement was added in T VSR, although
     // it could have been supported prior to this.
     static bool isP010Allowed();
@@ -35,6 +35,28 @@ public:
     static int32_t getInputBufferSize();
 
     static int32_t getEncAsyncOutputMode();
+
+    /* let encoder write output packet into c2 block directly */
+    static int32_t getEncZeroCopyOutput();
+
+    /* deliver encoder slices once ready if slice size is configured */
+    static int32_t getEncSliceOutput();
+
+    /* max frames and latency of one decoder output batch */
+    static int32_t getDecOutputBatchSize();
+    static int32_t getDecOutputBatchLatencyUs();
+
+    /* import dmabuf input packet to decoder without copy */
+    static int32_t getDecZeroCopyInput();
+
+    /* rows of one band in software frame conversion */
+    static int32_t getSwConvertBandRows();
+
+    /* max pre-initialized decoder contexts kept for fast restart, 0: disable */
+    static int32_t getDecWarmContextNum();
+
+    /* keep imported output buffers of decoder across flush and stop */
+    static int32_t getDecSoftStop();
 };
 
 #endif  // ANDROID_C2_RK_PROPS_DEF_H__
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2025 Rockchip Electronics Co. LTD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_C2_RK_THREAD_POOL_H_
+#define ANDROID_C2_RK_THREAD_POOL_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <thread>
+#include <vector>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+
+namespace android {
+
+/*
+ * Bounded worker pool shared by all codec instances, used to split cpu
+ * heavy per-frame work (e.g. software frame conversion) into bands.
+ */
+class C2RKThreadPool {
+public:
+    typedef std::function<void(int32_t begin, int32_t end)> RangeFunc;
+
+    static C2RKThreadPool* get() {
+        static C2RKThreadPool _gInstance;
+        return &_gInstance;
+    }
+
+    // Split [0, count) into bands of bandSize and run func on the pool
+    // workers together with the calling thread. Returns when all bands done.
+    void parallelFor(int32_t count, int32_t bandSize, const RangeFunc &func);
+
+private:
+    struct Job {
+        const RangeFunc     *func;
+        int32_t              count;
+        int32_t              bandSize;
+        int32_t              numBands;
+        std::atomic<int32_t> nextBand;
+        /* guarded by mLock */
+        int32_t              pendingBands;
+        int32_t              users;
+    };
+
+    C2RKThreadPool();
+    ~C2RKThreadPool();
+
+    void workerLoop();
+    int32_t runBands(Job *job);
+
+    Mutex                    mLock;
+    Condition                mJobCond;
+    Condition                mDoneCond;
+    std::list<Job*>          mJobs;
+    std::vector<std::thread> mWorkers;
+    bool                     mStopped;
+};
+
+} // namespace android
+
+#endif  // ANDROID_C2_RK_THREAD_POOL_H_
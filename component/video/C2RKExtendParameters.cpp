@@ -66,6 +66,18 @@ const std::vector<C2FieldDescriptor> C2SuperProcessStruct::_FIELD_LIST = {
     { C2FieldDescriptor::INT32, 1, "max-reenc-times", 12, 4 }
 };
 
+const std::vector<C2FieldDescriptor> C2SimulcastStruct::FieldList() {
+    return _FIELD_LIST;
+}
+const std::vector<C2FieldDescriptor> C2SimulcastStruct::_FIELD_LIST = {
+    { C2FieldDescriptor::INT32, 1, "layer1-width", 0, 4 },
+    { C2FieldDescriptor::INT32, 1, "layer1-height", 4, 4 },
+    { C2FieldDescriptor::INT32, 1, "layer1-bitrate", 8, 4 },
+    { C2FieldDescriptor::INT32, 1, "layer2-width", 12, 4 },
+    { C2FieldDescriptor::INT32, 1, "layer2-height", 16, 4 },
+    { C2FieldDescriptor::INT32, 1, "layer2-bitrate", 20, 4 }
+};
+
 const std::vector<C2FieldDescriptor> C2NumberStruct::FieldList() {
     return _FIELD_LIST;
 }
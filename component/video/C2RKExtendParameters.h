@@ -67,6 +67,8 @@ enum ExtendedC2ParamIndexKind : C2Param::type_index_t {
     kParamIndexEncRoiRegion4Cfg,
     kParamIndexEncPreProcess,
     kParamIndexEncSuperProcess,
+    kParamIndexEncSimulcast,
+    kParamIndexEncSimulcastLayer,
 };
 
 typedef C2PortParam<C2Info, C2Int32Value, kParamIndexDecDisableDpbCheck> C2StreamDecDisableDpbCheck;
@@ -212,6 +214,43 @@ struct C2SuperProcessStruct {
 typedef C2PortParam<C2Info, C2SuperProcessStruct, kParamIndexEncSuperProcess> C2StreamEncSuperProcess;
 constexpr char C2_PARAMKEY_ENC_SUPER_PROCESS[] = "c2-enc-super-process";
 
+/*
+ * Simulcast renditions of encoder
+ *
+ * Downscaled renditions encoded from the same input besides the main stream,
+ * a rendition is disabled if its width or height is 0. Renditions follow the
+ * main stream buffer in the output buffers of the same work, so clients which
+ * only take the first buffer get the main stream alone.
+ * widthN/heightN: picture size of rendition N
+ * bitrateN: target bitrate of rendition N, unit of measurement is bps.
+ */
+struct C2SimulcastStruct {
+    int32_t width1;
+    int32_t height1;
+    int32_t bitrate1;
+    int32_t width2;
+    int32_t height2;
+    int32_t bitrate2;
+
+    C2SimulcastStruct() :
+        width1(0), height1(0), bitrate1(0), width2(0), height2(0), bitrate2(0) {}
+    C2SimulcastStruct(
+        int32_t _width1, int32_t _height1, int32_t _bitrate1,
+        int32_t _width2, int32_t _height2, int32_t _bitrate2) :
+        width1(_width1), height1(_height1), bitrate1(_bitrate1),
+        width2(_width2), height2(_height2), bitrate2(_bitrate2) {}
+
+    const static std::vector<C2FieldDescriptor> _FIELD_LIST;
+    static const std::vector<C2FieldDescriptor> FieldList();
+};
+
+typedef C2PortParam<C2Info, C2SimulcastStruct, kParamIndexEncSimulcast> C2StreamEncSimulcast;
+constexpr char C2_PARAMKEY_ENC_SIMULCAST[] = "c2-enc-simulcast";
+
+/* rendition index of an output buffer in simulcast, 0 is the main stream */
+typedef C2PortParam<C2Info, C2Int32Value, kParamIndexEncSimulcastLayer> C2StreamEncSimulcastLayerInfo;
+constexpr char C2_PARAMKEY_ENC_SIMULCAST_LAYER[] = "c2-enc-simulcast-layer";
+
 /*
  * 1. MLVEC hardware driver version
  *    key-name: vendor.rtc-ext-enc-caps-vt-driver-version.number
@@ -38,6 +38,8 @@
 #include "C2RKDumpStateService.h"
 #include "C2RKTunneledSession.h"
 #include "C2RKPropsDef.h"
+#include "C2RKDmaBufSync.h"
+#include "C2RKMppCtxPool.h"
 #include "C2RKVersion.h"
 
 namespace android {
@@ -53,6 +55,12 @@ constexpr uint32_t kMaxVideoHeight = 4320;
 constexpr size_t kRenderSmoothnessFactor = 4;
 constexpr size_t kMinInputBufferSize = 2 * 1024 * 1024;
 
+/* max time of input packet blocked by a full decoder input queue */
+constexpr int64_t kInputBlockTimeoutUs = 3000000;
+constexpr int64_t kInputWaitSliceUs = 10000;
+// small packets are cheaper to copy than to import
+constexpr size_t kZeroCopyInputMinSize = 64 * 1024;
+
 struct MlvecParams {
     std::shared_ptr<C2DriverVersion::output> driverInfo;
     std::shared_ptr<C2LowLatencyMode::output> lowLatencyMode;
@@ -762,14 +770,21 @@ void C2RKMpiDec::WorkHandler::stop() {
 void C2RKMpiDec::WorkHandler::onMessageReceived(const sp<AMessage> &msg) {
     switch (msg->what()) {
         case kWhatFrameReady: {
-            if (mRunning) {
-                std::shared_ptr<C2RKMpiDec> thiz = mThiz.lock();
-                CHECK(thiz);
+            if (!mRunning) {
+                break;
+            }
 
-                if (thiz->drainWork() != C2_OK) {
-                    Log.E("Error DrainWork, stoping work looper...");
-                    mRunning = false;
-                }
+            std::shared_ptr<C2RKMpiDec> thiz = mThiz.lock();
+            if (!thiz) {
+                break;
+            }
+
+            // allow next frame ready callback to post new message
+            thiz->mFrameReadyPending = false;
+
+            if (thiz->drainWork() != C2_OK) {
+                Log.E("Error DrainWork, stoping work looper...");
+                mRunning = false;
             }
         } break;
         case kWhatFlushMessage: {
@@ -839,6 +854,14 @@ C2RKMpiDec::C2RKMpiDec(
       mDumpService(C2RKDumpStateService::get()),
       mLooper(nullptr),
       mHandler(nullptr),
+      mInputEventSeq(0),
+      mOutputFetching(false),
+      mInputBlockStats({0, 0, 0}),
+      mZeroCopyInput(C2RKPropsDef::getDecZeroCopyInput() != 0),
+      mSwConvertStats({0, 0, 0}),
+      mFrameReadyPending(false),
+      mOutputBatchSize(C2_MAX(C2RKPropsDef::getDecOutputBatchSize(), 1)),
+      mOutputBatchLatencyUs(C2RKPropsDef::getDecOutputBatchLatencyUs()),
       mMppCtx(nullptr),
       mMppMpi(nullptr),
       mCodingType(MPP_VIDEO_CodingUnused),
@@ -866,7 +889,11 @@ C2RKMpiDec::C2RKMpiDec(
       mTunneled(false),
       mBufferMode(false),
       mUseRgaBlit(true),
-      mStandardWorkFlow(true) {
+      mStandardWorkFlow(true),
+      mSoftStop(C2RKPropsDef::getDecSoftStop() != 0),
+      mStreamDpbInfo({0, 0, 0, 0}),
+      mCtxSetup({}),
+      mInitTimeStats({0, 0, false}) {
     Log.I("[%s] version %s", name, C2_COMPONENT_FULL_VERSION);
     mCodingType = (MppCodingType)GetMppCodingFromComponentName(name);
 }
@@ -940,6 +967,55 @@ void C2RKMpiDec::onNodeSummaryRequest(std::string &summary) {
             << "| State       : " << ((diff >= threshold) ? "Pipeline-Full" : "Normal") << "\n";
     }
 
+    {
+        Mutex::Autolock autoLock(mInputLock);
+        if (mInputBlockStats.blockCount > 0) {
+            oss << "| Input Block : " << mInputBlockStats.blockCount << " Times, "
+                << (mInputBlockStats.totalTimeUs / 1000) << " ms Totals, "
+                << (mInputBlockStats.maxTimeUs / 1000) << " ms Max\n";
+        }
+    }
+
+    if (mSwConvertStats.frameCount > 0) {
+        oss << "| SW Convert  : " << mSwConvertStats.frameCount << " Frames, "
+            << (mSwConvertStats.totalTimeUs / mSwConvertStats.frameCount) << " us Avg, "
+            << mSwConvertStats.maxTimeUs << " us Max\n";
+    }
+
+    {
+        int64_t hits = 0, misses = 0;
+        C2RKGraphicBufferMapper::get()->getCacheStats(&hits, &misses);
+        if (hits + misses > 0) {
+            oss << "| Mapper Cache: " << hits << " Hits, " << misses << " Misses ("
+                << (hits * 100 / (hits + misses)) << "% Hit Rate)\n";
+        }
+    }
+
+    {
+        int64_t count = 0, totalUs = 0, maxUs = 0;
+        getFetchStallStats(&count, &totalUs, &maxUs);
+        if (count > 0) {
+            oss << "| Fetch Stall : " << count << " Times, "
+                << (totalUs / count) << " us Avg, " << maxUs << " us Max\n";
+        }
+    }
+
+    if (mInitTimeStats.initTimeUs > 0) {
+        oss << "| Init Time   : " << mInitTimeStats.initTimeUs << " us, Surface Probe "
+            << mInitTimeStats.surfaceProbeUs << " us"
+            << (mInitTimeStats.surfaceSkipped ? " (Skipped)" : "") << "\n";
+    }
+
+    {
+        C2RKMppCtxPool::Stats stats;
+        C2RKMppCtxPool::get()->getStats(&stats);
+        if (stats.hitCount + stats.missCount > 0) {
+            oss << "| Warm Ctx    : " << stats.readyCount << " Ready, "
+                << stats.hitCount << " Hit, " << stats.missCount << " Miss, "
+                << stats.evictCount << " Evicted\n";
+        }
+    }
+
     summary += oss.str();
 }
 
@@ -1000,6 +1076,11 @@ void C2RKMpiDec::onRelease() {
 
     CHECK(stopAndReleaseLooper() == C2_OK);
 
+    {
+        Mutex::Autolock autoLock(mBufferLock);
+        releaseAllBuffers();
+    }
+
     if (mBlockPool) {
         mBlockPool.reset();
     }
@@ -1017,6 +1098,9 @@ void C2RKMpiDec::onRelease() {
     if (mMppCtx) {
         CHECK(mpp_destroy(mMppCtx) == MPP_OK);
         mMppCtx = nullptr;
+
+        // the next decoder of the same setup is likely to come soon
+        C2RKMppCtxPool::get()->prepare(mCtxSetup);
     }
 
     if (mTunneled) {
@@ -1026,6 +1110,7 @@ void C2RKMpiDec::onRelease() {
     stopFlushingState();
     setMppPerformance(false);
 
+    mStreamDpbInfo = {0, 0, 0, 0};
     mStarted = false;
 }
 
@@ -1046,21 +1131,42 @@ c2_status_t C2RKMpiDec::onFlush_sm() {
 
         Mutex::Autolock autoLock(mBufferLock);
 
-        releaseAllBuffers();
+        /*
+         * Soft stop: decoder drops its references of output buffers on reset,
+         * buffers stay imported and are reused on restart if the output pool
+         * and alloc params are unchanged, see updateDecoderArgs().
+         */
+        if (!mSoftStop || mTunneled) {
+            releaseAllBuffers();
+        }
 
         // reset dump statistics
         mDumpService->resetNode(this);
 
+        {
+            Mutex::Autolock autoLock(mInputLock);
+            mInputBlockStats = {0, 0, 0};
+        }
+
+        // decoder has dropped all input packets after reset
+        releaseInputHolds(UINT64_MAX);
+
         mFlushed = true;
     }
 
     return C2_OK;
 }
 
+void C2RKMpiDec::onFlushPending() {
+    // wake up input process blocked in sendpacket
+    signalInputAvailable();
+}
+
 c2_status_t C2RKMpiDec::setupAndStartLooper() {
     status_t err = OK;
 
     if (mLooper == nullptr) {
+        mFrameReadyPending = false;
         mLooper = new ALooper;
         mHandler = new WorkHandler(
                 std::static_pointer_cast<C2RKMpiDec>(sharedFromComponent()));
@@ -1111,8 +1217,9 @@ int32_t C2RKMpiDec::getFbcOutputMode(const std::unique_ptr<C2Work> &work) {
             return fbcMode;
         }
 
-        // do extra detection from spspps to search bitInfo in this case
-        if (work != nullptr && work->input.flags & C2FrameData::FLAG_CODEC_CONFIG) {
+        // do extra detection from spspps to search bitInfo in this case,
+        // sps may come with csd or inside the first frame packet
+        if (work != nullptr) {
             if (!work->input.buffers.empty()) {
                 C2ReadView rView = mDummyReadView;
                 rView = work->input.buffers[0]->data().linearBlocks().front().map().get();
@@ -1140,7 +1247,17 @@ int32_t C2RKMpiDec::getFbcOutputMode(const std::unique_ptr<C2Work> &work) {
     return fbcMode;
 }
 
-c2_status_t C2RKMpiDec::getSurfaceFeatures(const std::shared_ptr<C2BlockPool> &pool) {
+/*
+ * Surface features probed with a temporary block. Only surface pools need the
+ * probe, its result is not cached since the pool id is unique per instance.
+ */
+struct C2SurfaceFeatures {
+    uint64_t usage;
+    int32_t  needScale;
+};
+
+static c2_status_t probeSurfaceFeatures(
+        const std::shared_ptr<C2BlockPool> &pool, C2SurfaceFeatures *features) {
     c2_status_t err = C2_OK;
     std::shared_ptr<C2GraphicBlock> block;
 
@@ -1153,22 +1270,51 @@ c2_status_t C2RKMpiDec::getSurfaceFeatures(const std::shared_ptr<C2BlockPool> &p
         return err;
     }
 
-    buffer_handle_t handle = nullptr;
+    C2RKGraphicBufferMapper::BufferInfo info;
     auto c2Handle = block->handle();
 
-    status_t status = C2RKGraphicBufferMapper::get()->importBuffer(c2Handle, &handle);
+    status_t status = C2RKGraphicBufferMapper::get()->acquireBuffer(c2Handle, &info);
     if (status != OK) {
-        Log.PostError("importBuffer", static_cast<int32_t>(status));
+        Log.PostError("acquireBuffer", static_cast<int32_t>(status));
         return C2_CORRUPTED;
     }
 
-    uint64_t usage = C2RKGraphicBufferMapper::get()->getUsage(handle);
-    if (usage & GRALLOC_USAGE_HW_VIDEO_ENCODER) {
+    features->usage = info.usage;
+    features->needScale = 0;
+    if (!C2RKPropsDef::getScaleDisable() &&
+            C2RKChipCapDef::get()->getScaleMode() == C2_SCALE_MODE_META) {
+        features->needScale = C2RKVdecExtendFeature::checkNeedScale(info.handle);
+    }
+
+    C2RKGraphicBufferMapper::get()->releaseBuffer(info);
+    return C2_OK;
+}
+
+c2_status_t C2RKMpiDec::getSurfaceFeatures(const std::shared_ptr<C2BlockPool> &pool) {
+    c2_status_t err = C2_OK;
+    C2SurfaceFeatures features = { 0, 0 };
+    C2BlockPool::local_id_t poolId = pool->getLocalId();
+    int64_t startUs = ALooper::GetNowUs();
+
+    mInitTimeStats.surfaceSkipped = true;
+
+    // basic pool allocates with the requested usage, nothing to probe.
+    if (poolId > C2BlockPool::PLATFORM_START) {
+        err = probeSurfaceFeatures(pool, &features);
+        if (err != C2_OK) {
+            return err;
+        }
+        mInitTimeStats.surfaceSkipped = false;
+    }
+
+    mInitTimeStats.surfaceProbeUs = ALooper::GetNowUs() - startUs;
+
+    if (features.usage & GRALLOC_USAGE_HW_VIDEO_ENCODER) {
         mGraphicSourceMode = true;
         err = updateFbcModeIfNeeded();
         if (err != C2_OK) {
             Log.PostError("updateFbcModeIfNeeded", static_cast<int32_t>(err));
-            goto cleanUp;
+            return err;
         }
     }
 
@@ -1177,11 +1323,11 @@ c2_status_t C2RKMpiDec::getSurfaceFeatures(const std::shared_ptr<C2BlockPool> &p
     if (!mBufferMode && !C2RKPropsDef::getScaleDisable()) {
         switch (C2RKChipCapDef::get()->getScaleMode()) {
             case C2_SCALE_MODE_META: {
-                err = checkUseScaleMeta(handle);
+                err = checkUseScaleMeta(features.needScale);
                 break;
             }
             case C2_SCALE_MODE_DOWN_SCALE: {
-                err = checkUseScaleDown(handle);
+                err = checkUseScaleDown();
                 break;
             }
             default: {
@@ -1190,15 +1336,12 @@ c2_status_t C2RKMpiDec::getSurfaceFeatures(const std::shared_ptr<C2BlockPool> &p
         }
     }
 
-cleanUp:
-    std::ignore = C2RKGraphicBufferMapper::get()->freeBuffer(handle);
     return err;
 }
 
-c2_status_t C2RKMpiDec::checkUseScaleMeta(buffer_handle_t handle) {
+c2_status_t C2RKMpiDec::checkUseScaleMeta(int32_t needScale) {
     int32_t scaleMode = C2_SCALE_MODE_META;
 
-    int32_t needScale = C2RKVdecExtendFeature::checkNeedScale(handle);
     if (needScale <= 0) {
         scaleMode = C2_SCALE_MODE_NONE;
     }
@@ -1222,9 +1365,7 @@ c2_status_t C2RKMpiDec::checkUseScaleMeta(buffer_handle_t handle) {
     }
 }
 
-c2_status_t C2RKMpiDec::checkUseScaleDown(buffer_handle_t handle) {
-    (void)handle;
-
+c2_status_t C2RKMpiDec::checkUseScaleDown() {
     // enable scale dec only in 8k
     if (mWidth <= 4096 && mHeight <= 4096) {
         return C2_OK;
@@ -1249,7 +1390,7 @@ c2_status_t C2RKMpiDec::checkUseScaleDown(buffer_handle_t handle) {
 c2_status_t C2RKMpiDec::configOutputDelay(const std::unique_ptr<C2Work> &work) {
     c2_status_t err = C2_OK;
     uint32_t width = 0, height = 0, level = 0;
-    uint32_t dpbBasedRefCnt, protocolRefCnt = 0;
+    uint32_t dpbBasedRefCnt, protocolRefCnt = 0, streamRefCnt = 0;
     uint32_t numOutputSlots = 0;
 
     bool lowMemoryMode = false;
@@ -1272,6 +1413,8 @@ c2_status_t C2RKMpiDec::configOutputDelay(const std::unique_ptr<C2Work> &work) {
     if (work != nullptr) {
         C2ReadView rView = mDummyReadView;
         if (!work->input.buffers.empty()) {
+            int32_t maxDecBuffering = 0, maxNumReorder = 0;
+
             rView = work->input.buffers[0]->data().linearBlocks().front().map().get();
             protocolRefCnt = C2RKNaluParser::detectMaxRefCount(
                     const_cast<uint8_t *>(rView.data()), rView.capacity(), mCodingType);
@@ -1280,19 +1423,44 @@ c2_status_t C2RKMpiDec::configOutputDelay(const std::unique_ptr<C2Work> &work) {
             } else {
                 numOutputSlots = C2_MAX(dpbBasedRefCnt, protocolRefCnt);
             }
+
+            if (C2RKNaluParser::detectDpbInfo(
+                    const_cast<uint8_t *>(rView.data()), rView.capacity(),
+                    mCodingType, &maxDecBuffering, &maxNumReorder)) {
+                mStreamDpbInfo = { width, height, maxDecBuffering, maxNumReorder };
+            }
+        }
+    }
+
+    if (mStreamDpbInfo.maxDecBuffering > 0) {
+        if (mStreamDpbInfo.width == width && mStreamDpbInfo.height == height) {
+            streamRefCnt = C2RKMediaUtils::calculateStreamRefCount(
+                    mCodingType, width, height,
+                    C2_MAX(mStreamDpbInfo.maxDecBuffering, mStreamDpbInfo.maxNumReorder));
+            numOutputSlots = C2_MIN(numOutputSlots, streamRefCnt);
+        } else {
+            // picture size changed, the sps dpb info may not apply anymore
+            Log.I("size changed %dx%d -> %dx%d, drop stream dpb info",
+                   mStreamDpbInfo.width, mStreamDpbInfo.height, width, height);
+            mStreamDpbInfo = {0, 0, 0, 0};
         }
     }
 
     // limit output slots count
     numOutputSlots = C2_MIN(numOutputSlots, C2_MAX_REF_FRAME_COUNT);
 
-    if (numOutputSlots > mNumOutputSlots) {
+    /*
+     * Slots sized by the stream dpb info may be less than the one configured
+     * at init, which is allowed before the first output buffer is allocated.
+     */
+    if (numOutputSlots > mNumOutputSlots ||
+            (work != nullptr && streamRefCnt > 0 && numOutputSlots < mNumOutputSlots)) {
         uint32_t slotsToReduce = 0;
         std::vector<std::unique_ptr<C2SettingResult>> failures;
 
         Log.I("Codec(%s %dx%d) requires %d output slots based on %s",
                toStr_Coding(mCodingType), width, height, numOutputSlots,
-               (protocolRefCnt) ? "protocol" : "levelInfo");
+               (streamRefCnt) ? "streamDpb" : (protocolRefCnt) ? "protocol" : "levelInfo");
 
         /*
          * In low memory mode, reduce the reported output delay to minimize buffer
@@ -1301,7 +1469,7 @@ c2_status_t C2RKMpiDec::configOutputDelay(const std::unique_ptr<C2Work> &work) {
          * some buffer slots.
          */
         if (lowMemoryMode) {
-            slotsToReduce = C2_MIN(numOutputSlots, kRenderSmoothnessFactor - 1);
+            slotsToReduce = C2_MIN(numOutputSlots - 1, kRenderSmoothnessFactor - 1);
         }
 
         C2PortActualDelayTuning::output delay(numOutputSlots - slotsToReduce);
@@ -1378,6 +1546,9 @@ c2_status_t C2RKMpiDec::configTunneledPlayback(const std::unique_ptr<C2Work> &wo
 c2_status_t C2RKMpiDec::updateDecoderArgs(const std::shared_ptr<C2BlockPool> &pool) {
     c2_status_t err  = C2_OK;
     bool needsUpdate = false;
+    bool poolChanged = (mBlockPool && mBlockPool->getLocalId() != pool->getLocalId());
+    bool bufferMode  = mBufferMode;
+    AllocParams allocParams = mAllocParams;
 
     Log.TraceEnter();
 
@@ -1442,6 +1613,19 @@ c2_status_t C2RKMpiDec::updateDecoderArgs(const std::shared_ptr<C2BlockPool> &po
         }
     }
 
+    // buffers kept by soft stop are not compatible any more
+    if (mStarted && (poolChanged || bufferMode != mBufferMode ||
+            allocParams.width != mAllocParams.width ||
+            allocParams.height != mAllocParams.height ||
+            allocParams.usage != mAllocParams.usage ||
+            allocParams.format != mAllocParams.format)) {
+        Mutex::Autolock autoLock(mBufferLock);
+        if (!mBuffers.empty()) {
+            Log.I("release %zu kept buffers since output changed", mBuffers.size());
+            releaseAllBuffers();
+        }
+    }
+
     return err;
 }
 
@@ -1650,11 +1834,7 @@ c2_status_t C2RKMpiDec::updateMppFrameInfo(int32_t fbcMode) {
 c2_status_t C2RKMpiDec::initDecoder(const std::unique_ptr<C2Work> &work) {
     Log.Enter();
 
-    MPP_RET err = mpp_create(&mMppCtx, &mMppMpi);
-    if (err != MPP_OK) {
-        Log.PostError("mpp_create", static_cast<int32_t>(err));
-        return C2_CORRUPTED;
-    }
+    MPP_RET err = MPP_OK;
 
     {
         IntfImpl::Lock lock = mIntf->lock();
@@ -1687,48 +1867,25 @@ c2_status_t C2RKMpiDec::initDecoder(const std::unique_ptr<C2Work> &work) {
             splitMode = 1;
         }
 
-        err = mMppMpi->control(mMppCtx, MPP_DEC_SET_PARSER_FAST_MODE, &fastParse);
-        Log.PostErrorIf(err != MPP_OK, "setParserFastMode");
-
-        err = mMppMpi->control(mMppCtx, MPP_DEC_SET_ENABLE_FAST_PLAY, &fastPlay);
-        Log.PostErrorIf(err != MPP_OK, "setEnableFastPlay");
-
-        if (!deinterlace) {
-            Log.I("disable deinterlace mode");
-            err = mMppMpi->control(mMppCtx, MPP_DEC_SET_ENABLE_DEINTERLACE, &deinterlace);
-            Log.PostErrorIf(err != MPP_OK, "setEnableDeinterlace");
-        }
-
         if (splitMode) {
-            Log.I("enable parser split mode");
             mStandardWorkFlow = false;
-            err = mMppMpi->control(mMppCtx, MPP_DEC_SET_PARSER_SPLIT_MODE, &splitMode);
-            Log.PostErrorIf(err != MPP_OK, "setParserSplitMode");
         }
 
-        if (fastOut) {
-            Log.I("enable lowLatency fast-out mode");
-            err = mMppMpi->control(mMppCtx, MPP_DEC_SET_IMMEDIATE_OUT, &fastOut);
-            Log.PostErrorIf(err != MPP_OK, "setImmediateOut");
-        }
-
-        if (disableDpbCheck) {
-            Log.I("disable poc discontinuous check");
-            err = mMppMpi->control(mMppCtx, MPP_DEC_SET_DISABLE_DPB_CHECK, &disableDpbCheck);
-            Log.PostErrorIf(err != MPP_OK, "setDisableDpbCheck");
-        }
-
-        if (disableErrorMark) {
-            Log.I("disable error frame mark");
-            err = mMppMpi->control(mMppCtx, MPP_DEC_SET_DISABLE_ERROR, &disableErrorMark);
-            Log.PostErrorIf(err != MPP_OK, "setDisableError");
-        }
+        mCtxSetup = { mCodingType, fastParse, fastPlay, deinterlace,
+                      splitMode, fastOut, disableDpbCheck, disableErrorMark };
     }
 
-    err = mpp_init(mMppCtx, MPP_CTX_DEC, mCodingType);
-    if (err != MPP_OK) {
-        Log.PostError("mpp_init", static_cast<int32_t>(err));
-        goto error;
+    // adopt context prepared on last decoder release, mostly in channel switching
+    if (C2RKMppCtxPool::get()->acquire(mCtxSetup, &mMppCtx, &mMppMpi)) {
+        Log.I("adopt pre-initialized decoder context");
+    } else {
+        err = C2RKMppCtxPool::createContext(mCtxSetup, &mMppCtx, &mMppMpi);
+        if (err != MPP_OK) {
+            Log.PostError("createContext", static_cast<int32_t>(err));
+            mMppCtx = nullptr;
+            mMppMpi = nullptr;
+            goto error;
+        }
     }
 
     /* update frame info to decoder */
@@ -1864,7 +2021,8 @@ void C2RKMpiDec::finishConfigUpdate(std::unique_ptr<C2Param> config) {
 }
 
 void C2RKMpiDec::finishWork(
-        const std::unique_ptr<C2Work> &work, WorkEntry entry) {
+        const std::unique_ptr<C2Work> &work, WorkEntry entry,
+        std::list<std::unique_ptr<C2Work>> *batch) {
     std::shared_ptr<C2Buffer> c2Buffer = nullptr;
 
     std::shared_ptr<C2GraphicBlock> block = entry.block;
@@ -1893,7 +2051,7 @@ void C2RKMpiDec::finishWork(
         }
     }
 
-    auto fillWork = [c2Buffer, flags, timestamp, this](const std::unique_ptr<C2Work> &work) {
+    auto fillWork = [&c2Buffer, flags, timestamp, this](const std::unique_ptr<C2Work> &work) {
         work->worklets.front()->output.buffers.clear();
         work->worklets.front()->output.ordinal = work->input.ordinal;
         work->worklets.front()->output.ordinal.timestamp = timestamp;
@@ -1938,7 +2096,7 @@ void C2RKMpiDec::finishWork(
         fillWork(work);
     } else {
         if (isPendingWorkExist(frameIndex)) {
-            finish(frameIndex, fillWork);
+            finish(frameIndex, fillWork, batch);
         } else {
             // not present in the current peddingWorks, maybe interlaced video
             // source, sent through new work pipeline.
@@ -1950,7 +2108,7 @@ void C2RKMpiDec::finishWork(
             work->input.ordinal.frameIndex = OUTPUT_WORK_INDEX;
             work->worklets.front()->output.flags = C2FrameData::FLAG_INCOMPLETE;
 
-            finish(work, fillWork);
+            finish(work, fillWork, batch);
         }
     }
 }
@@ -2012,6 +2170,8 @@ void C2RKMpiDec::process(
 
     // Initialize decoder if not already initialized
     if (!mStarted) {
+        int64_t initStartUs = ALooper::GetNowUs();
+
         err = initDecoder(work);
         if (err != C2_OK) {
             work->result = C2_BAD_VALUE;
@@ -2050,6 +2210,12 @@ void C2RKMpiDec::process(
         // scene ddr frequency control
         setMppPerformance(true);
 
+        mInitTimeStats.initTimeUs = ALooper::GetNowUs() - initStartUs;
+        Log.I("init done in %lld us, surface probe %lld us%s",
+               (long long)mInitTimeStats.initTimeUs,
+               (long long)mInitTimeStats.surfaceProbeUs,
+               mInitTimeStats.surfaceSkipped ? " (skipped)" : "");
+
         mStarted = true;
     }
 
@@ -2091,7 +2257,13 @@ void C2RKMpiDec::process(
         }
     }
 
-    err = sendpacket(inData, inSize, timestamp, frameIndex, flags);
+    err = sendpacket(inData, inSize, timestamp, frameIndex, flags,
+                     inSize ? work->input.buffers[0] : nullptr);
+    if (err == C2_CANCELED) {
+        Log.I("discard packet(pts=%lld) since pending flush", timestamp);
+        fillEmptyWork(work);
+        return;
+    }
     if (err != C2_OK) {
         Log.PostError("sendPacket", static_cast<int32_t>(err));
         mSignalledError = true;
@@ -2231,16 +2403,17 @@ c2_status_t C2RKMpiDec::updateFbcModeIfNeeded() {
 
 c2_status_t C2RKMpiDec::importBufferToDecoder(std::shared_ptr<C2GraphicBlock> block) {
     auto c2Handle = block->handle();
-    buffer_handle_t handle = nullptr;
+    C2RKGraphicBufferMapper::BufferInfo info;
+    bool holdRef = false;
 
-    status_t err = C2RKGraphicBufferMapper::get()->importBuffer(c2Handle, &handle);
+    status_t err = C2RKGraphicBufferMapper::get()->acquireBuffer(c2Handle, &info);
     if (err != OK) {
-        Log.PostError("importBuffer", static_cast<int32_t>(err));
+        Log.PostError("acquireBuffer", static_cast<int32_t>(err));
         return C2_CORRUPTED;
     }
 
-    int32_t bufferFd = handle->data[0];
-    int32_t bufferId = C2RKGraphicBufferMapper::get()->getBufferId(handle);
+    int32_t bufferFd = info.handle->data[0];
+    int32_t bufferId = static_cast<int32_t>(info.bufferId);
 
     std::shared_ptr<OutBuffer> outBuffer = findOutBuffer(bufferId);
     if (outBuffer) {
@@ -2255,7 +2428,7 @@ c2_status_t C2RKMpiDec::importBufferToDecoder(std::shared_ptr<C2GraphicBlock> bl
 
         MppBufferInfo bufferInfo {
             .type  = MPP_BUFFER_TYPE_ION,
-            .size  = (size_t)(C2RKGraphicBufferMapper::get()->getAllocationSize(handle)),
+            .size  = (size_t)(info.allocationSize),
             .fd    = bufferFd,
             .index = bufferId,
             .ptr   = nullptr,
@@ -2271,7 +2444,7 @@ c2_status_t C2RKMpiDec::importBufferToDecoder(std::shared_ptr<C2GraphicBlock> bl
         }
 
         std::shared_ptr<OutBuffer> newBuffer =
-                std::make_shared<OutBuffer>(bufferId, bufferInfo.size, mppBuffer, block);
+                std::make_shared<OutBuffer>(bufferId, bufferInfo.size, mppBuffer, block, info);
 
         // signal buffer available to decoder
         newBuffer->submitToDecoder();
@@ -2291,13 +2464,17 @@ c2_status_t C2RKMpiDec::importBufferToDecoder(std::shared_ptr<C2GraphicBlock> bl
         }
 
         std::ignore = mBuffers.emplace(bufferId, std::move(newBuffer));
+        holdRef = true;
 
         Log.D("import this buffer, bufferId %d size %d listSize %d",
                bufferId, bufferInfo.size, mBuffers.size());
     }
 
 cleanUp:
-    std::ignore = C2RKGraphicBufferMapper::get()->freeBuffer(handle);
+    if (!holdRef) {
+        // out buffer keeps the reference until released
+        C2RKGraphicBufferMapper::get()->releaseBuffer(info);
+    }
     return (c2_status_t)err;
 }
 
@@ -2336,9 +2513,14 @@ c2_status_t C2RKMpiDec::ensureDecoderState() {
     Mutex::Autolock autoLock(mBufferLock);
 
     if (mTunneled && !mBuffers.empty()) {
-        return ensureTunneledState();
+        err = ensureTunneledState();
+        signalInputAvailable();
+        return err;
     }
 
+    // fetchGraphicBlock may get blocked while the consumer holds all buffers
+    markOutputFetching(true);
+
     int32_t width  = mAllocParams.width;
     int32_t height = mAllocParams.height;
     int64_t usage  = mAllocParams.usage;
@@ -2367,8 +2549,13 @@ c2_status_t C2RKMpiDec::ensureDecoderState() {
             err = mBlockPool->fetchGraphicBlock(bWidth, bHeight, bFormat,
                                                 C2AndroidMemoryUsage::FromGrallocUsage(bUsage),
                                                 &mOutBlock);
-            if (err != C2_OK) {
+            if (err == C2_CANCELED) {
+                // fetch interrupted by flush, not an error
+                markOutputFetching(false);
+                return C2_OK;
+            } else if (err != C2_OK) {
                 Log.PostError("fetchGraphicBlock", static_cast<int32_t>(err));
+                markOutputFetching(false);
                 return err;
             }
         }
@@ -2393,7 +2580,11 @@ c2_status_t C2RKMpiDec::ensureDecoderState() {
             err = mBlockPool->fetchGraphicBlock(width, height, format,
                                                 C2AndroidMemoryUsage::FromGrallocUsage(usage),
                                                 &block);
-            if (err != C2_OK) {
+            if (err == C2_CANCELED) {
+                // fetch interrupted by flush, not an error
+                err = C2_OK;
+                break;
+            } else if (err != C2_OK) {
                 Log.PostError("fetchGraphicBlock", static_cast<int32_t>(err));
                 break;
             }
@@ -2411,67 +2602,218 @@ c2_status_t C2RKMpiDec::ensureDecoderState() {
         }
     }
 
+    // buffers returned to decoder, signal input process
+    markOutputFetching(false);
+
     return err;
 }
 
+void C2RKMpiDec::markOutputFetching(bool fetching) {
+    Mutex::Autolock autoLock(mInputLock);
+    mOutputFetching = fetching;
+    if (!fetching) {
+        mInputEventSeq++;
+        mInputCond.broadcast();
+    }
+}
+
+void C2RKMpiDec::signalInputAvailable() {
+    Mutex::Autolock autoLock(mInputLock);
+    mInputEventSeq++;
+    mInputCond.broadcast();
+}
+
+void C2RKMpiDec::recordInputBlocked(int64_t blockTimeUs) {
+    Mutex::Autolock autoLock(mInputLock);
+    mInputBlockStats.blockCount++;
+    mInputBlockStats.totalTimeUs += blockTimeUs;
+    mInputBlockStats.maxTimeUs = C2_MAX(mInputBlockStats.maxTimeUs, blockTimeUs);
+}
+
 void C2RKMpiDec::postFrameReady() {
-    if (mHandler) {
+    // coalesce frame ready messages, drainWork pulls all ready frames
+    if (mHandler && !mFrameReadyPending.exchange(true)) {
         sp<AMessage> msg = new AMessage(WorkHandler::kWhatFrameReady, mHandler);
         CHECK(msg->post() == OK);
     }
+    // decoder made progress, input queue may have room now
+    signalInputAvailable();
 }
 
 c2_status_t C2RKMpiDec::drainWork(const std::unique_ptr<C2Work> &work) {
     if (mSignalledError) return C2_BAD_STATE;
 
-    WorkEntry entry = {};
+    // Output looper drains all ready frames in one pass and returns finished
+    // works together, bounded by batch size and latency of the first frame.
+    // EOS draining on given work keeps one frame per pass.
+    // NOTE: ensureDecoderState may block in fetchGraphicBlock until consumer
+    // returns a buffer, so batched works are always returned before it.
+    std::list<std::unique_ptr<C2Work>> batch;
+    std::list<std::unique_ptr<C2Work>> *outBatch = nullptr;
+    if (work == nullptr && mOutputBatchSize > 1) {
+        outBatch = &batch;
+    }
 
-outframe:
-    c2_status_t err = getoutframe(&entry);
-    if (err == C2_OK) {
-        finishWork(work, entry);
+    WorkEntry entry = {};
+    int32_t frameCount = 0;
+    int64_t startTimeUs = 0;
+    bool hasMoreFrames = false;
+    c2_status_t err = C2_OK;
 
-        err = ensureDecoderState();
-        if (err != C2_OK) {
-            goto error;
-        }
-    } else if (err == C2_NO_MEMORY) {
-        err = ensureDecoderState();
+    while (true) {
+        err = getoutframe(&entry);
         if (err == C2_OK) {
+            finishWork(work, entry, outBatch);
+            entry = {};
+
+            if (!outBatch || mBufferMode) {
+                // buffer mode copies each frame out, next frame needs a new block
+                if (outBatch) {
+                    finishBatch(outBatch);
+                }
+                err = ensureDecoderState();
+                if (err != C2_OK) {
+                    goto error;
+                }
+            }
+
+            if (!outBatch) {
+                // frame ready messages are coalesced, keep draining
+                hasMoreFrames = (work == nullptr);
+                break;
+            }
+
+            if (!startTimeUs) {
+                startTimeUs = ALooper::GetNowUs();
+            }
+            if ((++frameCount) >= mOutputBatchSize ||
+                    (ALooper::GetNowUs() - startTimeUs) >= mOutputBatchLatencyUs) {
+                hasMoreFrames = true;
+                break;
+            }
+        } else if (err == C2_NO_MEMORY) {
+            if (outBatch) {
+                finishBatch(outBatch);
+            }
+            err = ensureDecoderState();
+            if (err != C2_OK) {
+                goto error;
+            }
             // feekback config update to first output frame.
             entry.flags |= WorkEntry::FLAGS_INFO_CHANGE;
-            goto outframe;
-        } else {
+        } else if (err == C2_CORRUPTED) {
             goto error;
+        } else {
+            break;
         }
-    } else if (err == C2_CORRUPTED) {
-        goto error;
+    }
+
+    if (outBatch) {
+        finishBatch(outBatch);
+
+        // refill the buffers of drained frames once per batch
+        if (frameCount > 0 && !mBufferMode) {
+            err = ensureDecoderState();
+            if (err != C2_OK) {
+                goto error;
+            }
+        }
+    }
+    if (hasMoreFrames) {
+        // batch limit reached, continue draining in next message
+        postFrameReady();
     }
 
     return C2_OK;
 
 error:
+    if (outBatch) {
+        finishBatch(outBatch);
+    }
+
     Log.E("signalling error");
     mSignalledError = true;
 
     return C2_CORRUPTED;
 }
 
+c2_status_t C2RKMpiDec::importInputPacket(
+        const std::shared_ptr<C2Buffer> &buffer, size_t size, MppPacket *packet) {
+    C2ConstLinearBlock block = buffer->data().linearBlocks().front();
+    const C2Handle *handle = block.handle();
+
+    if (handle == nullptr || handle->numFds < 1 || !dma_buf_check_fd(handle->data[0])) {
+        return C2_OMITTED;
+    }
+
+    MppBuffer mppBuffer = nullptr;
+    MppBufferInfo bufferInfo {
+        .type  = MPP_BUFFER_TYPE_ION,
+        .size  = (size_t)(block.offset() + block.size()),
+        .fd    = handle->data[0],
+        .index = 0,
+        .ptr   = nullptr,
+        .hnd   = nullptr
+    };
+
+    MPP_RET err = mpp_buffer_import_with_tag(
+            nullptr, &bufferInfo, &mppBuffer, "codec2", __FUNCTION__);
+    if (err != MPP_OK) {
+        Log.W("failed to import input buffer, fd %d err %d", bufferInfo.fd, err);
+        return C2_CORRUPTED;
+    }
+
+    err = mpp_packet_init_with_buffer(packet, mppBuffer);
+    // packet holds its own reference of the buffer
+    std::ignore = mpp_buffer_put(mppBuffer);
+    if (err != MPP_OK) {
+        Log.W("failed to init packet with buffer, err %d", err);
+        return C2_CORRUPTED;
+    }
+
+    uint8_t *base = static_cast<uint8_t *>(mpp_packet_get_data(*packet));
+    mpp_packet_set_pos(*packet, base + block.offset());
+    mpp_packet_set_length(*packet, size);
+
+    return C2_OK;
+}
+
+void C2RKMpiDec::releaseInputHolds(uint64_t frameIndex) {
+    Mutex::Autolock autoLock(mInputLock);
+    while (!mInputHolds.empty() && mInputHolds.front().frameIndex <= frameIndex) {
+        mInputHolds.pop_front();
+    }
+}
+
 c2_status_t C2RKMpiDec::sendpacket(
         uint8_t *data, size_t size, uint64_t pts,
-        uint64_t frameIndex, uint32_t flags) {
+        uint64_t frameIndex, uint32_t flags,
+        const std::shared_ptr<C2Buffer> &buffer) {
     c2_status_t ret = C2_OK;
     MppPacket packet = nullptr;
+    MPP_RET err = MPP_OK;
+    bool zeroCopy = false;
 
-    MPP_RET err = mpp_packet_init(&packet, data, size);
-    if (err != MPP_OK) {
-        Log.PostError("mpp_packet_init", static_cast<int32_t>(err));
-        return C2_CORRUPTED;
+    // Input release relies on frameIndex of output frame, which is only
+    // reliable in standard workflow. Codec config goes to extra data copy.
+    if (mZeroCopyInput && buffer && mStandardWorkFlow &&
+            size >= kZeroCopyInputMinSize &&
+            !(flags & C2FrameData::FLAG_CODEC_CONFIG)) {
+        zeroCopy = (importInputPacket(buffer, size, &packet) == C2_OK);
+    }
+
+    if (!zeroCopy) {
+        err = mpp_packet_init(&packet, data, size);
+        if (err != MPP_OK) {
+            Log.PostError("mpp_packet_init", static_cast<int32_t>(err));
+            return C2_CORRUPTED;
+        }
+
+        mpp_packet_set_pos(packet, data);
+        mpp_packet_set_length(packet, size);
     }
 
     mpp_packet_set_pts(packet, pts);
-    mpp_packet_set_pos(packet, data);
-    mpp_packet_set_length(packet, size);
     // non-zero dts after decoding validates this method, so
     // we will never set dts to 0.
     // FIXME: better way to pass frameIndex.
@@ -2491,42 +2833,78 @@ c2_status_t C2RKMpiDec::sendpacket(
     /* dump frame time consuming if neccessary */
     mDumpService->recordFrameTime(this, pts);
 
-    static uint32_t kMaxRetryCnt = 1000;
-    uint32_t retry = 0;
+    uint32_t eventSeq = 0;
+    int64_t blockStartUs = 0;
+    int64_t deadlineUs = 0;
 
     while (true) {
+        {
+            Mutex::Autolock autoLock(mInputLock);
+            eventSeq = mInputEventSeq;
+        }
+
         err = mMppMpi->decode_put_packet(mMppCtx, packet);
         if (err == MPP_OK) {
-            Log.D("send packet pts %lld size %d", pts, size);
+            Log.D("send packet pts %lld size %d zeroCopy %d", pts, size, zeroCopy);
+            if (zeroCopy) {
+                // keep client buffer until decoder done with it
+                Mutex::Autolock autoLock(mInputLock);
+                mInputHolds.push_back({ frameIndex, buffer });
+            }
             /* record input packet buffer */
             bool skipStats = (flags & C2FrameData::FLAG_CODEC_CONFIG);
             mDumpService->recordFrame(this, data, size, skipStats);
             break;
         }
 
-        if (mSignalledError || ((++retry) > kMaxRetryCnt)) {
+        if (mSignalledError) {
             ret = C2_CORRUPTED;
             break;
-        } else if (retry % 200 == 0) {
+        }
+
+        if (isPendingFlushing()) {
+            ret = C2_CANCELED;
+            break;
+        }
+
+        int64_t nowUs = ALooper::GetNowUs();
+        if (!blockStartUs) {
+            blockStartUs = nowUs;
+            deadlineUs = nowUs + kInputBlockTimeoutUs;
+        }
+
+        Mutex::Autolock autoLock(mInputLock);
+        if (eventSeq != mInputEventSeq) {
+            // something happened since last try, resend immediately
+            continue;
+        }
+
+        if (nowUs >= deadlineUs) {
+            if (!mOutputFetching) {
+                Log.W("failed to send packet within %lld ms, pts %lld",
+                       kInputBlockTimeoutUs / 1000, pts);
+                ret = C2_CORRUPTED;
+                break;
+            }
             /*
-             * FIXME:
              * When player get paused, fetchGraphicBlock may get blocked since
              * surface fence paused. In this case, we are not able to output
-             * frame and then the input process stucked also.
-             *
-             * To solve this issue, we attempt to send packet continuely when
-             * fetchGraphicBlock get blocked. I still don't know is there a better
-             * way to know player get paused?
+             * frame and then the input process stucked also, so keep waiting
+             * until the output buffer get available.
              */
-            if (mBufferLock.tryLock() == NO_ERROR) {
-                Log.W("try to resend packet, pts %lld", pts);
-                mBufferLock.unlock();
-            } else {
-                retry = 0;
-            }
+            Log.W("input blocked by output buffer fetching, pts %lld", pts);
+            deadlineUs = nowUs + kInputBlockTimeoutUs;
         }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+        // wait for frame output, buffer return or flush to unblock decoder
+        // input queue. recheck periodically since decoder may consume packet
+        // without any notification.
+        std::ignore = mInputCond.waitRelative(
+                mInputLock, C2_MIN(deadlineUs - nowUs, kInputWaitSliceUs) * 1000LL);
+    }
+
+    if (blockStartUs) {
+        recordInputBlocked(ALooper::GetNowUs() - blockStartUs);
     }
 
     std::ignore = mpp_packet_deinit(&packet);
@@ -2649,6 +3027,11 @@ c2_status_t C2RKMpiDec::getoutframe(WorkEntry *entry) {
         goto cleanUp;
     }
 
+    // decoder has finished all input packets up to this frame
+    if (eos || dts) {
+        releaseInputHolds(eos ? UINT64_MAX : frameIdx);
+    }
+
     if (eos) {
         Log.I("get output eos");
         flags |= WorkEntry::FLAGS_EOS;
@@ -2714,11 +3097,18 @@ c2_status_t C2RKMpiDec::getoutframe(WorkEntry *entry) {
         if (!mUseRgaBlit) {
             uint8_t *srcPtr = (uint8_t*)mpp_buffer_get_ptr(mppBuffer);
             uint8_t *dstPtr = (uint8_t*)(dstView.data()[C2PlanarLayout::PLANE_Y]);
+            int64_t startUs = ALooper::GetNowUs();
 
             C2RKMediaUtils::translateToRequestFmt(
                     { srcPtr, srcFd, srcFmt, width, height, hstride, vstride },
                     { dstPtr, dstFd, dstFmt, width, height, dstStride, dstVStride },
                     true /* cache sync */);
+
+            int64_t costUs = ALooper::GetNowUs() - startUs;
+            mSwConvertStats.frameCount++;
+            mSwConvertStats.totalTimeUs += costUs;
+            mSwConvertStats.maxTimeUs = C2_MAX(mSwConvertStats.maxTimeUs, costUs);
+            Log.D("software convert cost %lld us", costUs);
         }
 
         entry->block = std::move(mOutBlock);
@@ -2783,6 +3173,7 @@ void C2RKMpiDec::releaseAllBuffers() {
         if (!pair.second->ownedByDecoder()) {
             pair.second->submitToDecoder();
         }
+        C2RKGraphicBufferMapper::get()->releaseBuffer(pair.second->mMapperInfo);
     }
     mBuffers.clear();
 
@@ -2838,15 +3229,17 @@ c2_status_t C2RKMpiDec::configFrameMetaIfNeeded(
         }
     }
 
-    buffer_handle_t handle = nullptr;
+    C2RKGraphicBufferMapper::BufferInfo info;
     auto c2Handle = block->handle();
 
-    status_t ret = C2RKGraphicBufferMapper::get()->importBuffer(c2Handle, &handle);
+    status_t ret = C2RKGraphicBufferMapper::get()->acquireBuffer(c2Handle, &info);
     if (ret != OK) {
-        Log.PostError("importBuffer", static_cast<int32_t>(ret));
+        Log.PostError("acquireBuffer", static_cast<int32_t>(ret));
         return C2_CORRUPTED;
     }
 
+    buffer_handle_t handle = info.handle;
+
     if (mScaleMode == C2_SCALE_MODE_META) {
         C2PreScaleParam scaleParam = {};
 
@@ -2871,7 +3264,7 @@ c2_status_t C2RKMpiDec::configFrameMetaIfNeeded(
         (void)C2RKVdecExtendFeature::configFrameHdrDynamicMeta(handle, hdrMetaOffset);
     }
 
-    std::ignore = C2RKGraphicBufferMapper::get()->freeBuffer(handle);
+    C2RKGraphicBufferMapper::get()->releaseBuffer(info);
     return C2_OK;
 }
 
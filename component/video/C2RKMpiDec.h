@@ -19,9 +19,13 @@
 
 #include "C2RKComponent.h"
 #include "C2RKInterface.h"
+#include "C2RKGraphicBufferMapper.h"
+#include "C2RKMppCtxPool.h"
 #include "rk_mpi.h"
 
+#include <atomic>
 #include <map>
+#include <utils/Condition.h>
 #include <utils/Vector.h>
 
 namespace android {
@@ -46,6 +50,7 @@ public:
     void onReset() override;
     void onRelease() override;
     c2_status_t onFlush_sm() override;
+    void onFlushPending() override;
 
     void process(
             const std::unique_ptr<C2Work> &work,
@@ -55,6 +60,7 @@ public:
             const std::shared_ptr<C2BlockPool> &pool) override;
 
     void postFrameReady();
+    void signalInputAvailable();
     c2_status_t drainWork(const std::unique_ptr<C2Work> &work = nullptr);
 
     // Implementation of virtual function from C2NodeInfoListener
@@ -90,14 +96,17 @@ private:
         bool      mOwnedByDecoder;
         MppBuffer mMppBuffer;
         std::shared_ptr<C2GraphicBlock> mBlock;
+        /* reference of mapper import cache, released with this buffer */
+        C2RKGraphicBufferMapper::BufferInfo mMapperInfo;
 
         OutBuffer(
                 int32_t bufferId,
                 int32_t size,
                 MppBuffer mppBuffer,
-                const std::shared_ptr<C2GraphicBlock> &block) :
+                const std::shared_ptr<C2GraphicBlock> &block,
+                const C2RKGraphicBufferMapper::BufferInfo &mapperInfo) :
                 mBufferId(bufferId), mSize(size), mOwnedByDecoder(false),
-                mMppBuffer(mppBuffer), mBlock(block) {}
+                mMppBuffer(mppBuffer), mBlock(block), mMapperInfo(mapperInfo) {}
 
         bool ownedByDecoder();
 
@@ -136,6 +145,47 @@ private:
     sp<ALooper>      mLooper;
     sp<WorkHandler>  mHandler;
 
+    /*
+     * Input backpressure: sendpacket waits on mInputCond while the decoder
+     * input queue is full, and is woken up by frame ready, buffer returns
+     * and flush/stop.
+     */
+    struct InputBlockStats {
+        int64_t blockCount;
+        int64_t totalTimeUs;
+        int64_t maxTimeUs;
+    };
+
+    Mutex            mInputLock;
+    Condition        mInputCond;
+    uint32_t         mInputEventSeq;
+    bool             mOutputFetching;
+    InputBlockStats  mInputBlockStats;
+
+    /*
+     * Zero-copy input: large dmabuf packets are imported to decoder directly,
+     * client buffers are held until the decoder outputs a frame behind them.
+     */
+    struct InputHold {
+        uint64_t frameIndex;
+        std::shared_ptr<C2Buffer> buffer;
+    };
+
+    bool             mZeroCopyInput;
+    std::list<InputHold> mInputHolds;
+
+    /* software conversion cost when rga blit is not available */
+    struct SwConvertStats {
+        int64_t frameCount;
+        int64_t totalTimeUs;
+        int64_t maxTimeUs;
+    } mSwConvertStats;
+
+    /* output batch draining, see drainWork() */
+    std::atomic<bool> mFrameReadyPending;
+    int32_t          mOutputBatchSize;
+    int64_t          mOutputBatchLatencyUs;
+
     /* MPI interface parameters */
     MppCtx           mMppCtx;
     MppApi          *mMppMpi;
@@ -171,6 +221,7 @@ private:
     bool mBufferMode;
     bool mUseRgaBlit;
     bool mStandardWorkFlow;
+    bool mSoftStop;
 
     std::shared_ptr<C2GraphicBlock> mOutBlock;
     std::shared_ptr<C2BlockPool>    mBlockPool;
@@ -200,6 +251,25 @@ private:
         }
     } mBitstreamColorAspects;
 
+    // Dpb buffering declared in sps, which is usually far below the level
+    // limits. Only valid for the picture size it was detected with.
+    struct StreamDpbInfo {
+        uint32_t width;
+        uint32_t height;
+        int32_t maxDecBuffering;
+        int32_t maxNumReorder;
+    } mStreamDpbInfo;
+
+    // setup of the mpp context, for adopting a pre-initialized one
+    C2RKMppCtxPool::Setup mCtxSetup;
+
+    /* decoder startup cost, measured on the first process() */
+    struct InitTimeStats {
+        int64_t initTimeUs;
+        int64_t surfaceProbeUs;
+        bool    surfaceSkipped;
+    } mInitTimeStats;
+
     c2_status_t setupAndStartLooper();
     c2_status_t stopAndReleaseLooper();
 
@@ -211,7 +281,9 @@ private:
     c2_status_t configTunneledPlayback(const std::unique_ptr<C2Work> &work);
     void fillEmptyWork(const std::unique_ptr<C2Work> &work);
     void finishConfigUpdate(std::unique_ptr<C2Param> config);
-    void finishWork(const std::unique_ptr<C2Work> &work, WorkEntry entry);
+    void finishWork(
+            const std::unique_ptr<C2Work> &work, WorkEntry entry,
+            std::list<std::unique_ptr<C2Work>> *batch = nullptr);
 
     c2_status_t initDecoder(const std::unique_ptr<C2Work> &work);
     c2_status_t updateDecoderArgs(const std::shared_ptr<C2BlockPool> &pool);
@@ -224,14 +296,20 @@ private:
     c2_status_t importBufferToDecoder(std::shared_ptr<C2GraphicBlock> block);
     c2_status_t ensureTunneledState();
     c2_status_t ensureDecoderState();
+    void markOutputFetching(bool fetching);
+    void recordInputBlocked(int64_t blockTimeUs);
+    c2_status_t importInputPacket(
+            const std::shared_ptr<C2Buffer> &buffer, size_t size, MppPacket *packet);
+    void releaseInputHolds(uint64_t frameIndex);
     c2_status_t sendpacket(
             uint8_t *data, size_t size, uint64_t pts,
-            uint64_t frameIndex, uint32_t flags);
+            uint64_t frameIndex, uint32_t flags,
+            const std::shared_ptr<C2Buffer> &buffer = nullptr);
     c2_status_t getoutframe(WorkEntry *entry);
 
     c2_status_t configFrameMetaIfNeeded(MppFrame frame, std::shared_ptr<C2GraphicBlock> block);
-    c2_status_t checkUseScaleMeta(buffer_handle_t handle);
-    c2_status_t checkUseScaleDown(buffer_handle_t handle);
+    c2_status_t checkUseScaleMeta(int32_t needScale);
+    c2_status_t checkUseScaleDown();
 
     void releaseAllBuffers();
     std::shared_ptr<OutBuffer> findOutBuffer(int32_t bufferId);
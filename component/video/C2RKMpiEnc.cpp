@@ -20,8 +20,7 @@
 #include <ui/GraphicBufferMapper.h>
 #include <ui/GraphicBufferAllocator.h>
 #include <cutils/properties.h>
-#include <chrono>
-#include <thread>
+#include <sys/stat.h>
 
 #include "mpp_rc_api.h"
 
@@ -37,15 +36,40 @@
 #include "C2RKGraphicBufferMapper.h"
 #include "C2RKDumpStateService.h"
 #include "C2RKPropsDef.h"
+#include "C2RKDmaBufSync.h"
 #include "C2RKMlvecLegacy.h"
 #include "C2RKMpiRoiUtils.h"
 #include "C2RKYolov5Session.h"
+#include "C2RKSimulcastLayer.h"
 #include "C2RKVersion.h"
 
 namespace android {
 
 C2_LOGGER_ENABLE("C2RKMpiEnc");
 
+// BufferQueue slots cached for input import
+constexpr size_t kMaxImportCacheSize = 16;
+
+/* max time of input frame blocked by a full encoder input queue */
+constexpr int64_t kInputBlockTimeoutUs = 3000000;
+constexpr int64_t kInputWaitSliceUs = 2000;
+
+/* RGA staging buffers in flight for RGBA or unaligned input */
+constexpr size_t kMaxStagingBuffers = 3;
+
+/* max time of waiting for the eos packet on input eos */
+constexpr int64_t kDrainEOSTimeoutUs = 2000000;
+
+/* max time of async output waiting for process() to queue the work */
+constexpr int64_t kWaitPendingTimeoutUs = 100000;
+
+/*
+ * zero-copy output block is sized from the rate control budget of one frame,
+ * with headroom for intra frames which take many times the average.
+ */
+constexpr int32_t kOutBlockBudgetRatio = 16;
+constexpr uint32_t kMinOutBlockSize = 256 * 1024;
+
 void ParseGop(
         const C2StreamGopTuning::output &gop,
         uint32_t *syncInterval, uint32_t *iInterval, uint32_t *maxBframes) {
@@ -509,6 +533,20 @@ public:
                 .withSetter(SuperProcessSetter)
                 .build());
 
+        addParameter(
+                DefineParam(mSimulcast, C2_PARAMKEY_ENC_SIMULCAST)
+                .withDefault(new C2StreamEncSimulcast::input())
+                .withFields({
+                    C2F(mSimulcast, width1).any(),
+                    C2F(mSimulcast, height1).any(),
+                    C2F(mSimulcast, bitrate1).any(),
+                    C2F(mSimulcast, width2).any(),
+                    C2F(mSimulcast, height2).any(),
+                    C2F(mSimulcast, bitrate2).any(),
+                })
+                .withSetter(SimulcastSetter)
+                .build());
+
         addParameter(
                 DefineParam(mMlvecParams->driverInfo, C2_PARAMKEY_MLVEC_ENC_DRI_VERSION)
                 .withConstValue(new C2DriverVersion::output(MLVEC_DRIVER_VERSION))
@@ -963,6 +1001,13 @@ public:
         return C2R::Ok();
     }
 
+    static C2R SimulcastSetter(
+            bool mayBlock, C2P<C2StreamEncSimulcast::input>& me) {
+        (void)mayBlock;
+        (void)me;
+        return C2R::Ok();
+    }
+
     static C2R MProfileLevelSetter(
             bool mayBlock, C2P<C2MProfileLevel::output> &me) {
         (void)mayBlock;
@@ -1142,6 +1187,8 @@ public:
     { return mPreProcess; }
     std::shared_ptr<C2StreamEncSuperProcess::input> getSuperProcess_l() const
     { return mSuperProcess; }
+    std::shared_ptr<C2StreamEncSimulcast::input> getSimulcast_l() const
+    { return mSimulcast; }
     std::shared_ptr<C2StreamEncSEModeSetting::input> getSuperEncodingSettings_l() const
     { return mSESettings; }
     std::shared_ptr<MlvecParams> getMlvecParams_l() const
@@ -1179,6 +1226,7 @@ private:
     std::shared_ptr<C2StreamEncRoiRegion4Cfg::input> mRoiRegion4Cfg;
     std::shared_ptr<C2StreamEncPreProcess::input> mPreProcess;
     std::shared_ptr<C2StreamEncSuperProcess::input> mSuperProcess;
+    std::shared_ptr<C2StreamEncSimulcast::input> mSimulcast;
     std::shared_ptr<MlvecParams> mMlvecParams;
 };
 
@@ -1287,6 +1335,14 @@ C2RKMpiEnc::C2RKMpiEnc(
       mMime(mime),
       mIntf(intfImpl),
       mDumpService(C2RKDumpStateService::get()),
+      mZeroCopyOutput(C2RKPropsDef::getEncZeroCopyOutput() != 0),
+      mImportCacheStats({0, 0}),
+      mInputEventSeq(0),
+      mInputBlockStats({0, 0, 0}),
+      mStagingWaitCount(0),
+      mSliceOutput(false),
+      mFirstSliceTimeUs(0),
+      mSliceOutputStats({0, 0, 0}),
       mRoiCtx(nullptr),
       mMppCtx(nullptr),
       mMppMpi(nullptr),
@@ -1416,6 +1472,34 @@ void C2RKMpiEnc::onNodeSummaryRequest(std::string &summary) {
         oss << "|\n|--------------Pipeline Runtime State--------------|\n"
             << "| Input Frame : " << (long long)inputFrames
             << " Totals, " << (long long)outputFrames << " Encoded\n";
+        if (mImportCacheStats.hits + mImportCacheStats.misses > 0) {
+            oss << "| Import Cache: " << (long long)mImportCacheStats.hits << " Hits, "
+                << (long long)mImportCacheStats.misses << " Misses\n";
+        }
+        if (mSliceOutputStats.frameCount > 0) {
+            oss << "| Slice Output: " << (long long)mSliceOutputStats.sliceCount << " Slices, "
+                << (mSliceOutputStats.aheadTimeUs / mSliceOutputStats.frameCount)
+                << " us Ahead Avg\n";
+        }
+        for (const auto &layer : getSimulcastLayers()) {
+            const C2RKSimulcastLayer::Config &config = layer->getConfig();
+            oss << "| Simulcast L" << config.layerId << ": " << config.width << "x"
+                << config.height << " " << (config.bitrate / 1000) << " kbps, "
+                << (long long)layer->getFrameCount() << " Encoded\n";
+        }
+    }
+
+    {
+        Mutex::Autolock autoLock(mInputLock);
+        if (mInputBlockStats.blockCount > 0) {
+            oss << "| Input Block : " << mInputBlockStats.blockCount << " Times, "
+                << (mInputBlockStats.totalTimeUs / mInputBlockStats.blockCount) << " us Avg, "
+                << (mInputBlockStats.maxTimeUs / 1000) << " ms Max\n";
+        }
+        if (!mStagingBuffers.empty()) {
+            oss << "| Staging Buf : " << mStagingBuffers.size() << " Allocated, "
+                << (long long)mStagingWaitCount << " Waits\n";
+        }
     }
 
     summary += oss.str();
@@ -1465,12 +1549,26 @@ c2_status_t C2RKMpiEnc::onInit() {
 
 c2_status_t C2RKMpiEnc::onFlush_sm() {
     Log.Enter();
+
+    if (mStarted && mMppMpi != nullptr) {
+        // encoder is done with all frames, their blocks are free to drop
+        CHECK(mMppMpi->reset(mMppCtx) == MPP_OK);
+
+        clearOutputBlocks();
+        clearStagingBuffers();
+    }
+
     return C2_OK;
 }
 
+void C2RKMpiEnc::onFlushPending() {
+    // wake up input process blocked in sendframe
+    signalInputAvailable();
+}
+
 c2_status_t C2RKMpiEnc::onStop() {
     Log.Enter();
-    return C2_OK;
+    return onFlush_sm();
 }
 
 void C2RKMpiEnc::onReset() {
@@ -1489,9 +1587,15 @@ void C2RKMpiEnc::onRelease() {
 
     CHECK(stopAndReleaseLooper() == C2_OK);
 
-    if (mDmaMem != nullptr) {
-        CHECK(GraphicBufferAllocator::get().free((buffer_handle_t)mDmaMem->handler) == OK);
-        mDmaMem.reset();
+    clearOutputBlocks();
+
+    clearImportCache();
+
+    clearStagingBuffers();
+
+    {
+        Mutex::Autolock autoLock(mSimulcastLock);
+        mSimulcastLayers.clear();
     }
 
     if (mRoiCtx != nullptr) {
@@ -1522,6 +1626,8 @@ void C2RKMpiEnc::onRelease() {
     mSawInputEOS = false;
     mOutputEOS = false;
     mSignalledError = false;
+    mSliceOutput = false;
+    mFirstSliceTimeUs = 0;
 }
 
 c2_status_t C2RKMpiEnc::setupBaseCodec() {
@@ -1682,6 +1788,14 @@ c2_status_t C2RKMpiEnc::setupSliceSize() {
         Log.I("setupSliceSize: slice-size %d", c2Size->value);
         err = mpp_enc_cfg_set_s32(mEncCfg, "split:mode", MPP_ENC_SPLIT_BY_BYTE);
         err = mpp_enc_cfg_set_s32(mEncCfg, "split:arg", c2Size->value);
+
+        if (C2RKPropsDef::getEncSliceOutput()) {
+            Log.I("setupSliceSize: enable low delay slice output");
+            err = mpp_enc_cfg_set_s32(mEncCfg, "split:out", MPP_ENC_SPLIT_OUT_LOWDELAY);
+            mSliceOutput = true;
+            // slices come in separate packets, no frame block to write into
+            mZeroCopyOutput = false;
+        }
     }
 
     return (c2_status_t)err;
@@ -2557,35 +2671,6 @@ c2_status_t C2RKMpiEnc::initEncoder() {
         mProfile = mIntf->getProfile_l(mCodingType);
     }
 
-    /*
-     * Note: To handle certain RGBA input formats, a temporary NV12 buffer is
-     * allocated to hold the output from RGA conversion since MPP does not support
-     * RGBA input directly. Additionally, this buffer is allocated within the 4GB
-     * address space to ensure optimal efficiency for RGA hardware access and DMA
-     * compatibility.
-     */
-    uint32_t stride = 0;
-    uint64_t usage = (GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN);
-    buffer_handle_t bufferHandle;
-
-    // allocate buffer within 4G to avoid rga2 error.
-    if (C2RKChipCapDef::get()->hasRga2()) {
-        usage = RK_GRALLOC_USAGE_WITHIN_4G;
-    }
-
-    status_t status = GraphicBufferAllocator::get().allocate(
-            C2_ALIGN(mSize->width, 16), C2_ALIGN(mSize->height, 16),
-            0x15 /* NV12 */, 1u /* layer count */,
-            usage, &bufferHandle, &stride, "C2RKMpiEnc");
-    CHECK(status == OK) << "Failed to allocate DMA memory";
-
-    mDmaMem = std::make_unique<MyDmaBuffer_t>();
-    mDmaMem->fd = C2RKGraphicBufferMapper::get()->getShareFd(bufferHandle);
-    mDmaMem->size = C2RKGraphicBufferMapper::get()->getAllocationSize(bufferHandle);
-    mDmaMem->handler = bufferHandle;
-
-    Log.I("alloc temporary DmaMem fd %d size %d", mDmaMem->fd, mDmaMem->size);
-
     // create mpp and init mpp
     err = mpp_create(&mMppCtx, &mMppMpi);
     CHECK(err == MPP_OK) << "Failed to create mpp context";
@@ -2620,6 +2705,8 @@ c2_status_t C2RKMpiEnc::initEncoder() {
         goto error;
     }
 
+    std::ignore = setupSimulcast();
+
     err = mpp_buffer_group_get_internal(&mGroup, MPP_BUFFER_TYPE_ION);
     if (err != MPP_OK) {
         Log.PostError("getMppBufferGroup", static_cast<int32_t>(err));
@@ -2663,29 +2750,47 @@ void C2RKMpiEnc::finishWork(
 
     void    *data   = mpp_packet_get_data(entry);
     size_t   len    = mpp_packet_get_length(entry);
-    size_t   size   = mpp_packet_get_size(entry);
     uint64_t frmIdx = mpp_packet_get_pts(entry);
+    bool     partial = isPartialPacket(entry);
+
+    // encoder wrote this packet into our block already
+    std::shared_ptr<C2LinearBlock> block = takeOutputBlock(entry, frmIdx);
 
     if (data != nullptr && len > 0) {
-        std::shared_ptr<C2LinearBlock> block;
-        C2MemoryUsage usage = { C2MemoryUsage::CPU_READ, C2MemoryUsage::CPU_WRITE };
+        size_t offset = 0;
+        if (block != nullptr) {
+            offset = (uint8_t *)mpp_packet_get_pos(entry) - (uint8_t *)data - block->offset();
+        }
+        if (block != nullptr && offset + len >= block->capacity()) {
+            // hardware stops at the end of the block, the packet is truncated
+            Log.W("packet of frameIndex %lld overflows output block, size %zu capacity %u, "
+                  "fallback to copy output", (long long)frmIdx, offset + len, block->capacity());
+            mZeroCopyOutput = false;
+            // drop the broken frame, restart the stream from a sync frame
+            std::ignore = mMppMpi->control(mMppCtx, MPP_ENC_SET_IDR_FRAME, nullptr);
+        } else if (block != nullptr) {
+            buffer = createLinearBuffer(block, offset, len);
+        } else {
+            C2MemoryUsage usage = { C2MemoryUsage::CPU_READ, C2MemoryUsage::CPU_WRITE };
 
-        c2_status_t ret = mBlockPool->fetchLinearBlock(size, usage, &block);
-        CHECK(ret == C2_OK) << "Failed to get linear memory";
+            // only payload length is needed, not the whole packet capacity
+            c2_status_t ret = mBlockPool->fetchLinearBlock(len, usage, &block);
+            CHECK(ret == C2_OK) << "Failed to get linear memory";
 
-        C2WriteView wView = block->map().get();
+            C2WriteView wView = block->map().get();
 
-        // copy mpp output to c2 output
-        (void)memcpy(wView.data(), data, len);
+            // copy mpp output to c2 output
+            (void)memcpy(wView.data(), data, len);
 
-        buffer = createLinearBuffer(block, 0, len);
+            buffer = createLinearBuffer(block, 0, len);
+        }
         MppMeta meta = mpp_packet_get_meta(entry);
         if (meta != nullptr) {
             int32_t isIntra = 0;
             MppFrame frame = nullptr;
 
             std::ignore = mpp_meta_get_s32(meta, KEY_OUTPUT_INTRA, &isIntra);
-            if (isIntra) {
+            if (isIntra && buffer != nullptr) {
                 Log.I("IDR frame produced");
                 std::ignore = buffer->setInfo(
                         std::make_shared<C2StreamPictureTypeMaskInfo::output>(
@@ -2695,19 +2800,77 @@ void C2RKMpiEnc::finishWork(
             std::ignore = mpp_meta_get_frame(meta, KEY_INPUT_FRAME, &frame);
             if (frame != nullptr) {
                 std::ignore = mpp_frame_deinit(&frame);
-            } else if (mHandler) {
+                // encoder is done with the input, return its staging buffer
+                releaseStagingBuffer(frmIdx);
+            } else if (mHandler && !partial) {
                 Log.W("unexpected null frame from input");
             }
         }
     }
 
+    // sync mode has the input consumed once its packet is out
+    if (!mHandler && !partial) {
+        releaseStagingBuffer(frmIdx);
+    }
+
     std::ignore = mpp_packet_deinit(&entry);
 
-    auto fillWork = [buffer](const std::unique_ptr<C2Work> &work) {
+    if (mSliceOutput) {
+        int64_t nowUs = ALooper::GetNowUs();
+        if (!mFirstSliceTimeUs) {
+            mFirstSliceTimeUs = nowUs;
+        }
+        mSliceOutputStats.sliceCount++;
+        if (!partial) {
+            mSliceOutputStats.frameCount++;
+            mSliceOutputStats.aheadTimeUs += nowUs - mFirstSliceTimeUs;
+            mFirstSliceTimeUs = 0;
+        }
+    }
+
+    // in async mode a packet may come out before process() queued its work
+    if (mHandler && !(work && c2_cntr64_t(frmIdx) == work->input.ordinal.frameIndex)) {
+        if (!waitPendingWork(frmIdx, kWaitPendingTimeoutUs)) {
+            Log.W("work of frameIndex %lld not queued in time", (long long)frmIdx);
+        }
+    }
+
+    if (partial) {
+        // send the slice ahead, the work is finished with the last slice
+        auto fillSlice = [&buffer](const std::unique_ptr<C2Work> &work) {
+            work->worklets.front()->output.flags = C2FrameData::FLAG_INCOMPLETE;
+            work->worklets.front()->output.buffers.clear();
+            if (buffer != nullptr) {
+                work->worklets.front()->output.buffers.push_back(buffer);
+            }
+            work->worklets.front()->output.ordinal = work->input.ordinal;
+            work->workletsProcessed = 1u;
+        };
+
+        cloneAndSend(frmIdx, work, fillSlice);
+        return;
+    }
+
+    /*
+     * simulcast renditions follow the main packet in the same worklet, the
+     * main packet is layer 0. MediaCodec clients only take the first buffer
+     * of a worklet, so they always get the main stream alone.
+     */
+    std::vector<std::shared_ptr<C2Buffer>> renditions;
+    collectSimulcastLayers(frmIdx, &renditions);
+    if (!renditions.empty() && buffer != nullptr) {
+        std::ignore = buffer->setInfo(
+                std::make_shared<C2StreamEncSimulcastLayerInfo::output>(0u, 0));
+    }
+
+    auto fillWork = [&buffer, &renditions](const std::unique_ptr<C2Work> &work) {
         work->worklets.front()->output.flags = (C2FrameData::flags_t)0;
         work->worklets.front()->output.buffers.clear();
         if (buffer != nullptr) {
             work->worklets.front()->output.buffers.push_back(buffer);
+            for (const auto &rendition : renditions) {
+                work->worklets.front()->output.buffers.push_back(rendition);
+            }
         }
         work->worklets.front()->output.ordinal = work->input.ordinal;
         work->workletsProcessed = 1u;
@@ -2724,30 +2887,52 @@ void C2RKMpiEnc::finishWork(
 }
 
 c2_status_t C2RKMpiEnc::drainEOS(const std::unique_ptr<C2Work> &work) {
+    c2_status_t ret = C2_OK;
+    MPP_RET err = MPP_OK;
+    MppPollType timeout = MPP_POLL_BLOCK;
+    int64_t deadlineUs = ALooper::GetNowUs() + kDrainEOSTimeoutUs;
+
     if (mHandler) {
         mHandler->stopWorkLooper();
     }
 
-    int64_t maxTimeUs = 2000000; /* 2s */
-    int64_t startTimeUs = ALooper::GetNowUs();
-
-    while (true) {
-        if (C2_OK != onDrainWork(work)) {
-            goto error;
+    /*
+     * Block in encode_get_packet until the next packet or the deadline,
+     * instead of polling. The output timeout of mpp is updated for each
+     * packet to keep within the deadline.
+     */
+    while (!mOutputEOS) {
+        int64_t remainUs = deadlineUs - ALooper::GetNowUs();
+        if (remainUs <= 0) {
+            Log.W("failed to get output eos within %lld ms", kDrainEOSTimeoutUs / 1000);
+            ret = C2_TIMED_OUT;
+            break;
         }
 
-        if (mOutputEOS) {
+        timeout = static_cast<MppPollType>(std::max(remainUs / 1000, (int64_t)1));
+        err = mMppMpi->control(mMppCtx, MPP_SET_OUTPUT_TIMEOUT, &timeout);
+        if (err != MPP_OK) {
+            Log.PostError("setOutputTimeout", static_cast<int32_t>(err));
+            ret = C2_CORRUPTED;
             break;
         }
 
-        if (ALooper::GetNowUs() - startTimeUs >= maxTimeUs) {
-            Log.W("failed to get output eos within 2 seconds");
-            goto error;
-        } else {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ret = onDrainWork(work);
+        if (ret == C2_NOT_FOUND) {
+            // get packet timed out, check the deadline again
+            ret = C2_OK;
+        } else if (ret != C2_OK) {
+            break;
         }
     }
 
+    timeout = MPP_POLL_BLOCK;
+    std::ignore = mMppMpi->control(mMppCtx, MPP_SET_OUTPUT_TIMEOUT, &timeout);
+
+    if (ret != C2_OK) {
+        goto error;
+    }
+
     return C2_OK;
 
 error:
@@ -2772,13 +2957,26 @@ c2_status_t C2RKMpiEnc::onDrainWork(const std::unique_ptr<C2Work> &work) {
     }
 
     MppPacket entry = {};
+    c2_status_t err = C2_OK;
+    bool partial = false;
 
-    c2_status_t err = getoutpacket(&entry);
-    if (err == C2_OK) {
+    // take all slices of the frame in slice output mode
+    do {
+        err = getoutpacket(&entry);
+        if (err != C2_OK) {
+            break;
+        }
+
+        partial = isPartialPacket(entry);
         finishWork(work, entry);
-    } else if (err == C2_CORRUPTED) {
+        // encoder input queue gets room once a packet is out
+        signalInputAvailable();
+    } while (partial);
+
+    if (err == C2_CORRUPTED) {
         Log.E("signalling error");
         mSignalledError = true;
+        signalInputAvailable();
     }
 
     return err;
@@ -2879,12 +3077,24 @@ void C2RKMpiEnc::process(
     MyDmaBuffer_t dmaBuf = {};
 
     err = getInBufferFromWork(work, &dmaBuf);
+    if (err == C2_CANCELED) {
+        Log.I("discard frame(pts=%lld) since pending flush", timestamp);
+        fillEmptyWork(work);
+        return;
+    }
     if (err != C2_OK) {
+        Log.PostError("getInBufferFromWork", static_cast<int32_t>(err));
+        releaseStagingBuffer(frameIndex);
         mSignalledError = true;
         work->result = C2_CORRUPTED;
         return;
     }
 
+    // send simulcast renditions ahead, they are encoded along with main frame
+    if (dmaBuf.fd > 0) {
+        sendSimulcastLayers(work, dmaBuf);
+    }
+
     // In smart v3 mode, handle yolov5 rknn object detection.
     // not set workletsProcessed to indicates that the current work incomplete.
     // and will finish this work later in sesssion callback.
@@ -2899,6 +3109,11 @@ void C2RKMpiEnc::process(
 
     /* send frame to mpp */
     err = sendframe(dmaBuf, frameIndex, flags);
+    if (err == C2_CANCELED) {
+        Log.I("discard frame(pts=%lld) since pending flush", timestamp);
+        fillEmptyWork(work);
+        return;
+    }
     if (err != C2_OK) {
         Log.PostError("sendFrame", static_cast<int32_t>(err));
         mSignalledError = true;
@@ -3153,6 +3368,9 @@ c2_status_t C2RKMpiEnc::onDetectResultReady(ImageBuffer *srcImage, void *result)
     if (err == C2_OK) {
         /* get and drain output work */
         err = onDrainWork();
+    } else if (err == C2_CANCELED) {
+        Log.D("discard frame since pending flush");
+        return C2_OK;
     }
 
     if (err != C2_OK) {
@@ -3262,18 +3480,23 @@ c2_status_t C2RKMpiEnc::getInBufferFromWork(
             c2Handle, &width, &height, &format, &usage,
             &stride, &generation, &bqId, &bqSlot);
 
+    bool cacheHit = false;
+    ImportEntry *entry = lookupImportCache(
+            c2Handle->data[0], bqId, bqSlot, generation, &cacheHit);
+    if (cacheHit && stride == 0) {
+        stride = entry->stride;
+    }
+
     // Fix error for wifidisplay when stride is 0
     if (stride == 0) {
         std::vector<ui::PlaneLayout> layouts;
-        buffer_handle_t bufferHandle;
-        native_handle_t *grallocHandle = UnwrapNativeCodec2GrallocHandle(c2Handle);
+        C2RKGraphicBufferMapper::BufferInfo info;
 
-        GraphicBufferMapper &gm(GraphicBufferMapper::get());
-        status_t err = gm.importBuffer(const_cast<native_handle_t *>(grallocHandle),
-                                       width, height, 1, format, usage,
-                                       stride, &bufferHandle);
+        // share the import with other users of the same buffer
+        status_t err = C2RKGraphicBufferMapper::get()->acquireBuffer(c2Handle, &info);
         if (err == OK) {
-            err = gm.getPlaneLayouts(const_cast<native_handle_t *>(bufferHandle), &layouts);
+            err = GraphicBufferMapper::get().getPlaneLayouts(info.handle, &layouts);
+            C2RKGraphicBufferMapper::get()->releaseBuffer(info);
         }
         if (err == OK && layouts[0].sampleIncrementInBits != 0) {
             stride = layouts[0].strideInBytes * 8 / layouts[0].sampleIncrementInBits;
@@ -3281,8 +3504,10 @@ c2_status_t C2RKMpiEnc::getInBufferFromWork(
             Log.E("layouts[0].sampleIncrementInBits = 0");
             stride = mHorStride;
         }
-        std::ignore = gm.freeBuffer(bufferHandle);
-        std::ignore = native_handle_delete(grallocHandle);
+    }
+
+    if (entry != nullptr) {
+        entry->stride = stride;
     }
 
     /* dump frame time consuming if neccessary */
@@ -3319,21 +3544,26 @@ c2_status_t C2RKMpiEnc::getInBufferFromWork(
 
             outBuffer->fd = fd;
             outBuffer->size = mHorStride * mVerStride * 4;
+            outBuffer->mppBuffer = getImportedBuffer(entry, fd, outBuffer->size);
         } else {
             RgaInfo srcInfo, dstInfo;
 
             C2RKRgaDef::SetRgaInfo(
                     &srcInfo, fd, HAL_PIXEL_FORMAT_RGBA_8888,
                     mSize->width, mSize->height, stride, height);
+            ret = acquireStagingBuffer(frameIndex, outBuffer);
+            if (ret != C2_OK) {
+                break;
+            }
+
             C2RKRgaDef::SetRgaInfo(
-                    &dstInfo, mDmaMem->fd, HAL_PIXEL_FORMAT_YCrCb_NV12,
+                    &dstInfo, outBuffer->fd, HAL_PIXEL_FORMAT_YCrCb_NV12,
                     mSize->width, mSize->height, mHorStride, mVerStride);
             if (!C2RKRgaDef::DoBlit(srcInfo, dstInfo)) {
                 Log.E("failed to RgaConver(RGBA->NV12)");
                 ret = C2_CORRUPTED;
             }
 
-            outBuffer->fd = mDmaMem->fd;
             outBuffer->size = mHorStride * mVerStride * 3 / 2;
         }
     } break;
@@ -3362,21 +3592,26 @@ c2_status_t C2RKMpiEnc::getInBufferFromWork(
 
             outBuffer->fd = fd;
             outBuffer->size = mHorStride * mVerStride * 3 / 2;
+            outBuffer->mppBuffer = getImportedBuffer(entry, fd, outBuffer->size);
         } else {
             RgaInfo srcInfo, dstInfo;
 
             C2RKRgaDef::SetRgaInfo(
                     &srcInfo, fd, HAL_PIXEL_FORMAT_YCrCb_NV12,
                     mSize->width, mSize->height, stride, height);
+            ret = acquireStagingBuffer(frameIndex, outBuffer);
+            if (ret != C2_OK) {
+                break;
+            }
+
             C2RKRgaDef::SetRgaInfo(
-                    &dstInfo, mDmaMem->fd, HAL_PIXEL_FORMAT_YCrCb_NV12,
+                    &dstInfo, outBuffer->fd, HAL_PIXEL_FORMAT_YCrCb_NV12,
                     mSize->width, mSize->height, mHorStride, mVerStride);
             if (!C2RKRgaDef::DoBlit(srcInfo, dstInfo)) {
                 Log.E("failed to RgaCrop(NV12->NV12)");
                 ret = C2_CORRUPTED;
             }
 
-            outBuffer->fd = mDmaMem->fd;
             outBuffer->size = mHorStride * mVerStride * 3 / 2;
         }
     } break;
@@ -3412,9 +3647,9 @@ c2_status_t C2RKMpiEnc::sendframe(
     MPP_RET err = MPP_OK;
     MppFrame frame = nullptr;
     MppMeta meta = nullptr;
-    uint32_t retry = 0;
-
-    static uint32_t kMaxRetryCnt = 1000;
+    uint32_t eventSeq = 0;
+    int64_t blockStartUs = 0;
+    int64_t deadlineUs = 0;
 
     err = mpp_frame_init(&frame);
     CHECK(err == MPP_OK) << "Failed to initialize frame";
@@ -3426,7 +3661,10 @@ c2_status_t C2RKMpiEnc::sendframe(
         mpp_frame_set_eos(frame, 1);
     }
 
-    if (dBuffer.fd > 0) {
+    if (dBuffer.mppBuffer != nullptr) {
+        // cached import, frame takes its own reference
+        mpp_frame_set_buffer(frame, dBuffer.mppBuffer);
+    } else if (dBuffer.fd > 0) {
         MppBuffer buffer = nullptr;
         MppBufferInfo commit = {};
 
@@ -3445,6 +3683,12 @@ c2_status_t C2RKMpiEnc::sendframe(
         mpp_frame_set_buffer(frame, nullptr);
     }
 
+    // cached and fresh imports both take an output block
+    if (mpp_frame_get_buffer(frame) != nullptr && mZeroCopyOutput) {
+        // frame without output block falls back to copy output
+        std::ignore = attachOutputBlock(meta, pts);
+    }
+
     mpp_frame_set_width(frame, mSize->width);
     mpp_frame_set_height(frame, mSize->height);
     mpp_frame_set_ver_stride(frame, mVerStride);
@@ -3521,6 +3765,11 @@ c2_status_t C2RKMpiEnc::sendframe(
     }
 
     while (true) {
+        {
+            Mutex::Autolock autoLock(mInputLock);
+            eventSeq = mInputEventSeq;
+        }
+
         err = mMppMpi->encode_put_frame(mMppCtx, frame);
         if (err == MPP_OK) {
             Log.D("send frame fd %d size %d pts %lld", dBuffer.fd, dBuffer.size, pts);
@@ -3528,22 +3777,442 @@ c2_status_t C2RKMpiEnc::sendframe(
             break;
         }
 
-        if (mSignalledError || ((++retry) > kMaxRetryCnt)) {
+        if (mSignalledError) {
             ret = C2_CORRUPTED;
-            goto error;
+            break;
+        }
+
+        if (isPendingFlushing()) {
+            ret = C2_CANCELED;
+            break;
+        }
+
+        int64_t nowUs = ALooper::GetNowUs();
+        if (!blockStartUs) {
+            blockStartUs = nowUs;
+            deadlineUs = nowUs + kInputBlockTimeoutUs;
         }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+        if (nowUs >= deadlineUs) {
+            Log.W("failed to send frame within %lld ms, pts %lld",
+                   kInputBlockTimeoutUs / 1000, pts);
+            ret = C2_CORRUPTED;
+            break;
+        }
+
+        Mutex::Autolock autoLock(mInputLock);
+        if (eventSeq != mInputEventSeq) {
+            // packet output since last try, resend immediately
+            continue;
+        }
+
+        // wait for packet output or flush to unblock encoder input queue.
+        // recheck in short slice since encoder takes frame from input queue
+        // without any notification.
+        std::ignore = mInputCond.waitRelative(
+                mInputLock, std::min(deadlineUs - nowUs, kInputWaitSliceUs) * 1000LL);
+    }
+
+    if (blockStartUs) {
+        recordInputBlocked(ALooper::GetNowUs() - blockStartUs);
     }
 
 error:
-    if (!mHandler && frame != nullptr) {
+    if (ret != C2_OK) {
+        detachOutputBlock(meta, pts);
+        releaseStagingBuffer(pts);
+    }
+
+    // async mode frame is released with its output packet, once sent
+    if ((!mHandler || ret != C2_OK) && frame != nullptr) {
         std::ignore = mpp_frame_deinit(&frame);
     }
 
     return ret;
 }
 
+void C2RKMpiEnc::signalInputAvailable() {
+    Mutex::Autolock autoLock(mInputLock);
+    mInputEventSeq++;
+    mInputCond.broadcast();
+}
+
+void C2RKMpiEnc::recordInputBlocked(int64_t blockTimeUs) {
+    Mutex::Autolock autoLock(mInputLock);
+    mInputBlockStats.blockCount++;
+    mInputBlockStats.totalTimeUs += blockTimeUs;
+    mInputBlockStats.maxTimeUs = std::max(mInputBlockStats.maxTimeUs, blockTimeUs);
+}
+
+c2_status_t C2RKMpiEnc::acquireStagingBuffer(uint64_t pts, MyDmaBuffer_t *outBuffer) {
+    uint32_t width = mSize->width;
+    uint32_t height = mSize->height;
+    int64_t deadlineUs = 0;
+    auto target = mStagingBuffers.end();
+
+    Mutex::Autolock autoLock(mInputLock);
+
+    while (target == mStagingBuffers.end()) {
+        for (auto it = mStagingBuffers.begin(); it != mStagingBuffers.end();) {
+            if (it->busy) {
+                it++;
+            } else if (it->width == width && it->height == height) {
+                target = it;
+                break;
+            } else {
+                // picture size changed, drop the stale one
+                freeStagingBuffer(&(*it));
+                it = mStagingBuffers.erase(it);
+            }
+        }
+        if (target != mStagingBuffers.end()) {
+            break;
+        }
+
+        if (mStagingBuffers.size() < kMaxStagingBuffers) {
+            /*
+             * Note: To handle certain RGBA input formats, a temporary NV12
+             * buffer is allocated to hold the output from RGA conversion since
+             * MPP does not support RGBA input directly. Additionally, this
+             * buffer is allocated within the 4GB address space to ensure
+             * optimal efficiency for RGA hardware access and DMA compatibility.
+             */
+            uint32_t stride = 0;
+            uint64_t usage = (GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN);
+            buffer_handle_t bufferHandle;
+
+            // allocate buffer within 4G to avoid rga2 error.
+            if (C2RKChipCapDef::get()->hasRga2()) {
+                usage = RK_GRALLOC_USAGE_WITHIN_4G;
+            }
+
+            status_t status = GraphicBufferAllocator::get().allocate(
+                    C2_ALIGN(width, 16), C2_ALIGN(height, 16),
+                    0x15 /* NV12 */, 1u /* layer count */,
+                    usage, &bufferHandle, &stride, "C2RKMpiEnc");
+            if (status != OK) {
+                Log.E("failed to allocate staging buffer, err %d", status);
+                return C2_NO_MEMORY;
+            }
+
+            StagingBuffer buffer = {};
+            buffer.dma.fd = C2RKGraphicBufferMapper::get()->getShareFd(bufferHandle);
+            buffer.dma.size = C2RKGraphicBufferMapper::get()->getAllocationSize(bufferHandle);
+            buffer.dma.handler = bufferHandle;
+            buffer.width = width;
+            buffer.height = height;
+
+            // import once, each frame takes its own reference
+            MppBufferInfo commit = {};
+            commit.type = MPP_BUFFER_TYPE_ION;
+            commit.fd   = buffer.dma.fd;
+            commit.size = buffer.dma.size;
+            if (mpp_buffer_import(&buffer.dma.mppBuffer, &commit) != MPP_OK) {
+                Log.W("failed to import staging buffer fd %d", buffer.dma.fd);
+                buffer.dma.mppBuffer = nullptr;
+            }
+
+            Log.I("alloc staging buffer %zu fd %d size %d",
+                   mStagingBuffers.size(), buffer.dma.fd, buffer.dma.size);
+
+            target = mStagingBuffers.insert(mStagingBuffers.end(), buffer);
+            break;
+        }
+
+        // all buffers are still held by encoder, wait for a packet output
+        int64_t nowUs = ALooper::GetNowUs();
+        if (!deadlineUs) {
+            deadlineUs = nowUs + kInputBlockTimeoutUs;
+            mStagingWaitCount++;
+        }
+
+        // never recycle a busy buffer, encoder may still read from it
+        if (isPendingFlushing()) {
+            return C2_CANCELED;
+        }
+
+        if (nowUs >= deadlineUs) {
+            Log.W("no staging buffer returned within %lld ms, pts %lld",
+                   kInputBlockTimeoutUs / 1000, pts);
+            return C2_TIMED_OUT;
+        }
+
+        std::ignore = mInputCond.waitRelative(mInputLock, (deadlineUs - nowUs) * 1000LL);
+    }
+
+    // keep in acquire order, the front is the oldest in flight
+    mStagingBuffers.splice(mStagingBuffers.end(), mStagingBuffers, target);
+
+    target->busy = true;
+    target->pts = pts;
+    *outBuffer = target->dma;
+
+    return C2_OK;
+}
+
+void C2RKMpiEnc::releaseStagingBuffer(uint64_t pts) {
+    Mutex::Autolock autoLock(mInputLock);
+
+    for (StagingBuffer &buffer : mStagingBuffers) {
+        if (buffer.busy && buffer.pts == pts) {
+            buffer.busy = false;
+            mInputEventSeq++;
+            mInputCond.broadcast();
+            break;
+        }
+    }
+}
+
+void C2RKMpiEnc::freeStagingBuffer(StagingBuffer *buffer) {
+    if (buffer->dma.mppBuffer != nullptr) {
+        std::ignore = mpp_buffer_put(buffer->dma.mppBuffer);
+        buffer->dma.mppBuffer = nullptr;
+    }
+    CHECK(GraphicBufferAllocator::get().free(
+            (buffer_handle_t)buffer->dma.handler) == OK);
+}
+
+void C2RKMpiEnc::clearStagingBuffers() {
+    Mutex::Autolock autoLock(mInputLock);
+
+    for (StagingBuffer &buffer : mStagingBuffers) {
+        freeStagingBuffer(&buffer);
+    }
+    mStagingBuffers.clear();
+}
+
+C2RKMpiEnc::ImportEntry* C2RKMpiEnc::lookupImportCache(
+        int32_t fd, uint64_t bqId, uint32_t bqSlot, uint32_t generation, bool *hit) {
+    struct stat st;
+
+    *hit = false;
+
+    // buffers not from BufferQueue have no stable identity
+    if (bqId == 0 || fstat(fd, &st) < 0) {
+        return nullptr;
+    }
+
+    for (auto it = mImportCache.begin(); it != mImportCache.end(); ) {
+        if (it->bqId == bqId && it->generation != generation) {
+            // BufferQueue reconnected, all slots of old generation are gone
+            if (it->mppBuffer) {
+                std::ignore = mpp_buffer_put(it->mppBuffer);
+            }
+            it = mImportCache.erase(it);
+            continue;
+        }
+        if (it->bqId == bqId && it->bqSlot == bqSlot) {
+            if (it->inode == st.st_ino) {
+                // move to front as most recently used
+                mImportCache.splice(mImportCache.begin(), mImportCache, it);
+                mImportCacheStats.hits++;
+                *hit = true;
+                return &mImportCache.front();
+            }
+            // slot reallocated with a new buffer
+            if (it->mppBuffer) {
+                std::ignore = mpp_buffer_put(it->mppBuffer);
+            }
+            it = mImportCache.erase(it);
+            continue;
+        }
+        ++it;
+    }
+
+    mImportCacheStats.misses++;
+
+    if (mImportCache.size() >= kMaxImportCacheSize) {
+        if (mImportCache.back().mppBuffer) {
+            std::ignore = mpp_buffer_put(mImportCache.back().mppBuffer);
+        }
+        mImportCache.pop_back();
+    }
+
+    mImportCache.push_front({ bqId, bqSlot, generation, st.st_ino, 0, 0, nullptr });
+    return &mImportCache.front();
+}
+
+MppBuffer C2RKMpiEnc::getImportedBuffer(ImportEntry *entry, int32_t fd, int32_t size) {
+    if (entry == nullptr) {
+        return nullptr;
+    }
+
+    if (entry->mppBuffer && entry->size == size) {
+        return entry->mppBuffer;
+    }
+
+    if (entry->mppBuffer) {
+        // stride config changed, import again with the new size
+        std::ignore = mpp_buffer_put(entry->mppBuffer);
+        entry->mppBuffer = nullptr;
+    }
+
+    MppBufferInfo commit = {};
+    commit.type = MPP_BUFFER_TYPE_ION;
+    commit.fd   = fd;
+    commit.size = size;
+
+    MPP_RET err = mpp_buffer_import(&entry->mppBuffer, &commit);
+    if (err != MPP_OK) {
+        Log.W("failed to import input buffer fd %d, err %d", fd, err);
+        entry->mppBuffer = nullptr;
+        return nullptr;
+    }
+
+    entry->size = size;
+    return entry->mppBuffer;
+}
+
+void C2RKMpiEnc::clearImportCache() {
+    for (ImportEntry &entry : mImportCache) {
+        if (entry.mppBuffer) {
+            std::ignore = mpp_buffer_put(entry.mppBuffer);
+        }
+    }
+    mImportCache.clear();
+}
+
+uint32_t C2RKMpiEnc::getOutputBlockSize() {
+    MppErrorTrap err;
+    int32_t rcMode = 0, bpsMax = 0, fps = 0;
+
+    // the same capacity as mpp internal packet buffer
+    uint32_t frameSize = C2_ALIGN(mHorStride * mVerStride * 3 / 2, 4096);
+
+    err = mpp_enc_cfg_get_s32(mEncCfg, "rc:mode", &rcMode);
+    err = mpp_enc_cfg_get_s32(mEncCfg, "rc:bps_max", &bpsMax);
+    err = mpp_enc_cfg_get_s32(mEncCfg, "rc:fps_out_num", &fps);
+
+    // fixqp has no bitrate bound on packet size
+    if (err != MPP_OK || rcMode == MPP_ENC_RC_MODE_FIXQP || bpsMax <= 0 || fps <= 0) {
+        return frameSize;
+    }
+
+    uint64_t budget = (uint64_t)bpsMax / 8 / fps * kOutBlockBudgetRatio;
+    budget = std::clamp(budget, (uint64_t)kMinOutBlockSize, (uint64_t)frameSize);
+
+    return C2_ALIGN((uint32_t)budget, 4096);
+}
+
+c2_status_t C2RKMpiEnc::attachOutputBlock(MppMeta meta, uint64_t pts) {
+    std::shared_ptr<C2LinearBlock> block;
+    C2MemoryUsage usage = { C2MemoryUsage::CPU_READ, C2MemoryUsage::CPU_WRITE };
+    MppBuffer buffer = nullptr;
+    MppPacket packet = nullptr;
+
+    uint32_t size = getOutputBlockSize();
+
+    // fetch failure is transient (e.g. canceled on flush), copy this frame only
+    c2_status_t ret = mBlockPool->fetchLinearBlock(size, usage, &block);
+    if (ret != C2_OK) {
+        Log.W("failed to fetch output block, err %d", ret);
+        return ret;
+    }
+
+    const C2Handle *handle = block->handle();
+    if (handle == nullptr || handle->numFds < 1 || !dma_buf_check_fd(handle->data[0])) {
+        Log.I("output block not importable, fallback to copy output");
+        mZeroCopyOutput = false;
+        return C2_OMITTED;
+    }
+
+    MppBufferInfo commit = {};
+    commit.type = MPP_BUFFER_TYPE_ION;
+    commit.fd   = handle->data[0];
+    commit.size = block->offset() + block->capacity();
+
+    MPP_RET err = mpp_buffer_import(&buffer, &commit);
+    if (err != MPP_OK) {
+        Log.W("failed to import output block, fallback to copy output, err %d", err);
+        mZeroCopyOutput = false;
+        return C2_CORRUPTED;
+    }
+
+    err = mpp_packet_init_with_buffer(&packet, buffer);
+    // packet holds its own reference of the buffer
+    std::ignore = mpp_buffer_put(buffer);
+    if (err != MPP_OK) {
+        Log.W("failed to init output packet, err %d", err);
+        return C2_CORRUPTED;
+    }
+
+    uint8_t *base = static_cast<uint8_t *>(mpp_packet_get_data(packet));
+    mpp_packet_set_pos(packet, base + block->offset());
+    // NOTE: clear length to let encoder write from the beginning
+    mpp_packet_set_length(packet, 0);
+
+    err = mpp_meta_set_packet(meta, KEY_OUTPUT_PACKET, packet);
+    if (err != MPP_OK) {
+        std::ignore = mpp_packet_deinit(&packet);
+        return C2_CORRUPTED;
+    }
+
+    Mutex::Autolock autoLock(mOutBlockLock);
+    mOutBlocks[pts] = { packet, std::move(block) };
+
+    return C2_OK;
+}
+
+void C2RKMpiEnc::detachOutputBlock(MppMeta meta, uint64_t pts) {
+    MppPacket packet = nullptr;
+
+    if (meta == nullptr) {
+        return;
+    }
+
+    if (mpp_meta_get_packet(meta, KEY_OUTPUT_PACKET, &packet) == MPP_OK && packet) {
+        std::ignore = mpp_packet_deinit(&packet);
+    }
+
+    Mutex::Autolock autoLock(mOutBlockLock);
+    std::ignore = mOutBlocks.erase(pts);
+}
+
+std::shared_ptr<C2LinearBlock> C2RKMpiEnc::takeOutputBlock(MppPacket packet, uint64_t pts) {
+    std::shared_ptr<C2LinearBlock> block = nullptr;
+
+    Mutex::Autolock autoLock(mOutBlockLock);
+    if (mOutBlocks.empty()) {
+        return nullptr;
+    }
+
+    auto it = mOutBlocks.find(pts);
+    // make sure packet data really lives in this block, old mpp ignores
+    // user output packet and returns its internal packet.
+    if (it != mOutBlocks.end()) {
+        if (it->second.packet == packet) {
+            block = std::move(it->second.block);
+            // released by the caller as output packet
+            it->second.packet = nullptr;
+        } else {
+            Log.I("user output packet not supported, fallback to copy output");
+            mZeroCopyOutput = false;
+        }
+    }
+
+    // output follows input order, blocks of earlier frames are dropped
+    auto end = mOutBlocks.upper_bound(pts);
+    for (auto iter = mOutBlocks.begin(); iter != end; iter++) {
+        if (iter->second.packet != nullptr) {
+            std::ignore = mpp_packet_deinit(&iter->second.packet);
+        }
+    }
+    mOutBlocks.erase(mOutBlocks.begin(), end);
+
+    return block;
+}
+
+void C2RKMpiEnc::clearOutputBlocks() {
+    Mutex::Autolock autoLock(mOutBlockLock);
+
+    for (auto &entry : mOutBlocks) {
+        if (entry.second.packet != nullptr) {
+            std::ignore = mpp_packet_deinit(&entry.second.packet);
+        }
+    }
+    mOutBlocks.clear();
+}
+
 c2_status_t C2RKMpiEnc::getoutpacket(MppPacket *entry) {
     MPP_RET err = MPP_OK;
     MppPacket packet = nullptr;
@@ -3559,10 +4228,15 @@ c2_status_t C2RKMpiEnc::getoutpacket(MppPacket *entry) {
 
         Log.D("get outpacket pts %lld size %d eos %d", pts, len, eos);
 
-        /* record output packet buffer */
-        mDumpService->recordFrame(this, data, len);
+        if (isPartialPacket(packet)) {
+            /* record output slice, stats and timing go with the last one */
+            mDumpService->recordFrame(this, data, len, true /* skipStats */);
+        } else {
+            /* record output packet buffer */
+            mDumpService->recordFrame(this, data, len);
 
-        mDumpService->showFrameTiming(this, pts);
+            mDumpService->showFrameTiming(this, pts);
+        }
 
         if (eos) {
             Log.I("get output eos");
@@ -3574,6 +4248,133 @@ c2_status_t C2RKMpiEnc::getoutpacket(MppPacket *entry) {
     }
 }
 
+c2_status_t C2RKMpiEnc::setupSimulcast() {
+    IntfImpl::Lock lock = mIntf->lock();
+    std::shared_ptr<C2StreamEncSimulcast::input> simulcast = mIntf->getSimulcast_l();
+    lock.unlock();
+
+    const C2RKSimulcastLayer::Config configs[] = {
+        { 1, simulcast->width1, simulcast->height1, simulcast->bitrate1 },
+        { 2, simulcast->width2, simulcast->height2, simulcast->bitrate2 },
+    };
+
+    for (const C2RKSimulcastLayer::Config &config : configs) {
+        if (config.width <= 0 || config.height <= 0) {
+            continue;
+        }
+        if (config.width > static_cast<int32_t>(mSize->width) ||
+                config.height > static_cast<int32_t>(mSize->height)) {
+            Log.W("setupSimulcast: ignore layer %d [%d %d] larger than input",
+                   config.layerId, config.width, config.height);
+            continue;
+        }
+
+        C2RKSimulcastLayer::Config layerConfig = config;
+        if (layerConfig.bitrate <= 0) {
+            // scale bitrate of main stream by picture area
+            layerConfig.bitrate = static_cast<int32_t>(
+                    static_cast<int64_t>(mBitrate->value) * config.width * config.height
+                    / (mSize->width * mSize->height));
+        }
+
+        auto layer = std::make_shared<C2RKSimulcastLayer>(layerConfig);
+        if (layer->init(mCodingType, mMppCtx, mMppMpi) != C2_OK) {
+            Log.W("setupSimulcast: failed to init layer %d", config.layerId);
+            continue;
+        }
+
+        Mutex::Autolock autoLock(mSimulcastLock);
+        mSimulcastLayers.push_back(layer);
+    }
+
+    return C2_OK;
+}
+
+std::vector<std::shared_ptr<C2RKSimulcastLayer>> C2RKMpiEnc::getSimulcastLayers() {
+    Mutex::Autolock autoLock(mSimulcastLock);
+    return mSimulcastLayers;
+}
+
+void C2RKMpiEnc::sendSimulcastLayers(
+        const std::unique_ptr<C2Work> &work, MyDmaBuffer_t dbuffer) {
+    uint64_t frameIndex = work->input.ordinal.frameIndex.peekull();
+    bool forceIdr = false;
+
+    C2RKSimulcastLayer::Source src = {
+        .fd        = dbuffer.fd,
+        .format    = (mInputMppFmt == MPP_FMT_RGBA8888) ?
+                HAL_PIXEL_FORMAT_RGBA_8888 : HAL_PIXEL_FORMAT_YCrCb_NV12,
+        .width     = static_cast<int32_t>(mSize->width),
+        .height    = static_cast<int32_t>(mSize->height),
+        .horStride = mHorStride,
+        .verStride = mVerStride,
+    };
+
+    {
+        // sync request is cleared later by the main encoder
+        IntfImpl::Lock lock = mIntf->lock();
+        forceIdr = mIntf->getRequestSync_l()->value;
+    }
+
+    // packets are taken in finishWork(), layers encode along with main encoder
+    for (const auto &layer : getSimulcastLayers()) {
+        if (layer->sendFrame(src, frameIndex, forceIdr) != C2_OK) {
+            Log.W("layer %d: drop frameIndex %lld", layer->getConfig().layerId, frameIndex);
+        }
+    }
+}
+
+void C2RKMpiEnc::collectSimulcastLayers(
+        uint64_t frameIndex, std::vector<std::shared_ptr<C2Buffer>> *buffers) {
+    for (const auto &layer : getSimulcastLayers()) {
+        int32_t layerId = layer->getConfig().layerId;
+        MppPacket packet = nullptr;
+
+        if (layer->getPacket(frameIndex, &packet) != C2_OK) {
+            continue;
+        }
+
+        void  *data = mpp_packet_get_data(packet);
+        size_t len  = mpp_packet_get_length(packet);
+
+        if (data != nullptr && len > 0) {
+            std::shared_ptr<C2LinearBlock> block;
+            C2MemoryUsage usage = { C2MemoryUsage::CPU_READ, C2MemoryUsage::CPU_WRITE };
+
+            c2_status_t ret = mBlockPool->fetchLinearBlock(len, usage, &block);
+            if (ret == C2_OK) {
+                C2WriteView wView = block->map().get();
+                (void)memcpy(wView.data(), data, len);
+
+                std::shared_ptr<C2Buffer> buffer = createLinearBuffer(block, 0, len);
+                std::ignore = buffer->setInfo(
+                        std::make_shared<C2StreamEncSimulcastLayerInfo::output>(0u, layerId));
+
+                int32_t isIntra = 0;
+                MppMeta meta = mpp_packet_get_meta(packet);
+                if (meta != nullptr) {
+                    std::ignore = mpp_meta_get_s32(meta, KEY_OUTPUT_INTRA, &isIntra);
+                }
+                if (isIntra) {
+                    std::ignore = buffer->setInfo(
+                            std::make_shared<C2StreamPictureTypeMaskInfo::output>(
+                            0u /* stream id */, C2Config::SYNC_FRAME));
+                }
+                buffers->push_back(buffer);
+            } else {
+                Log.W("layer %d: failed to fetch output block, err %d", layerId, ret);
+            }
+        }
+
+        std::ignore = mpp_packet_deinit(&packet);
+    }
+}
+
+bool C2RKMpiEnc::isPartialPacket(MppPacket packet) {
+    // the last slice of a frame is marked as end of image
+    return mSliceOutput && mpp_packet_is_partition(packet) && !mpp_packet_is_eoi(packet);
+}
+
 class C2RKMpiEncFactory : public C2ComponentFactory {
 public:
     explicit C2RKMpiEncFactory(std::string name)
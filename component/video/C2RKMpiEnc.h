@@ -22,13 +22,22 @@
 
 #include "rk_mpi.h"
 
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <sys/types.h>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
 #include <utils/Vector.h>
+#include <vector>
 
 namespace android {
 
 class C2RKMlvecLegacy;
 class C2RKDumpStateService;
 class C2RKYolov5Session;
+class C2RKSimulcastLayer;
 struct ImageBuffer;
 struct RoiRegionCfg;
 
@@ -48,6 +57,7 @@ public:
     void onReset() override;
     void onRelease() override;
     c2_status_t onFlush_sm() override;
+    void onFlushPending() override;
     void process(
             const std::unique_ptr<C2Work> &work,
             const std::shared_ptr<C2BlockPool> &pool) override;
@@ -70,8 +80,29 @@ private:
         int32_t  size;
         void    *npuMaps;
         const void *handler; /* buffer_handle_t */
+        MppBuffer mppBuffer; /* cached import of fd, optional */
     } MyDmaBuffer_t;
 
+    /*
+     * Imported input buffer cache. Cameras and screen capture cycle through a
+     * small set of BufferQueue slots, so keep the MppBuffer and stride of each
+     * slot to avoid import syscalls and mapper queries in steady state.
+     */
+    struct ImportEntry {
+        uint64_t  bqId;
+        uint32_t  bqSlot;
+        uint32_t  generation;
+        ino_t     inode;  /* identify the dmabuf behind the slot */
+        uint32_t  stride;
+        int32_t   size;
+        MppBuffer mppBuffer;
+    };
+
+    struct ImportCacheStats {
+        int64_t hits;
+        int64_t misses;
+    };
+
     /* Supported lists for InputFormat */
     typedef enum {
         C2_INPUT_FMT_UNKNOWN = 0,
@@ -121,11 +152,81 @@ private:
     std::shared_ptr<C2RKMlvecLegacy>   mMlvec;
     // npu object detection
     std::shared_ptr<C2RKYolov5Session> mRknnSession;
-    std::unique_ptr<MyDmaBuffer_t>     mDmaMem;
 
     sp<ALooper>      mLooper;
     sp<WorkHandler>  mHandler;
 
+    /*
+     * Zero-copy output: a c2 linear block is attached to each input frame as
+     * output packet buffer, keyed by frameIndex until the packet comes out.
+     */
+    struct OutBlock {
+        MppPacket packet;
+        std::shared_ptr<C2LinearBlock> block;
+    };
+
+    Mutex            mOutBlockLock;
+    // cleared on the output looper, read on process()
+    std::atomic<bool> mZeroCopyOutput;
+    std::map<uint64_t, OutBlock> mOutBlocks;
+
+    std::list<ImportEntry> mImportCache;
+    ImportCacheStats mImportCacheStats;
+
+    /*
+     * Input backpressure in async mode: sendframe waits on mInputCond while
+     * the non-blocking encoder input queue is full, and is woken up by packet
+     * output, error and flush/stop.
+     */
+    struct InputBlockStats {
+        int64_t blockCount;
+        int64_t totalTimeUs;
+        int64_t maxTimeUs;
+    };
+
+    Mutex            mInputLock;
+    Condition        mInputCond;
+    uint32_t         mInputEventSeq;
+    InputBlockStats  mInputBlockStats;
+
+    /*
+     * RGA staging buffers for RGBA or unaligned input, allocated on demand.
+     * A buffer is owned by the frame converted into it until the encoder
+     * returns that frame with its packet, guarded by mInputLock.
+     */
+    struct StagingBuffer {
+        MyDmaBuffer_t dma;
+        uint32_t width;
+        uint32_t height;
+        bool     busy;
+        uint64_t pts;
+    };
+
+    std::list<StagingBuffer> mStagingBuffers;
+    int64_t          mStagingWaitCount;
+
+    /*
+     * Low-delay slice output: each slice packet is sent to client once ready
+     * as an incomplete work, and the work is finished with the last slice.
+     */
+    struct SliceOutputStats {
+        int64_t frameCount;
+        int64_t sliceCount;
+        int64_t aheadTimeUs;  /* first slice ahead of the whole frame */
+    };
+
+    bool             mSliceOutput;
+    int64_t          mFirstSliceTimeUs;
+    SliceOutputStats mSliceOutputStats;
+
+    /*
+     * Simulcast renditions, scaled from the input of main encoder in process()
+     * and taken with the main packet of the same frame. Each rendition is an
+     * extra output buffer of the work after the main packet.
+     */
+    Mutex            mSimulcastLock;
+    std::vector<std::shared_ptr<C2RKSimulcastLayer>> mSimulcastLayers;
+
     void            *mRoiCtx;
 
     /* MPI interface parameters */
@@ -183,6 +284,7 @@ private:
     c2_status_t setupIntraRefresh();
     c2_status_t setupSuperModeIfNeeded();
     c2_status_t setupMlvecIfNeeded();
+    c2_status_t setupSimulcast();
     c2_status_t setupEncCfg();
 
     c2_status_t initEncoder();
@@ -200,8 +302,32 @@ private:
     c2_status_t getInBufferFromWork(
             const std::unique_ptr<C2Work> &work, MyDmaBuffer_t *outBuffer);
     c2_status_t sendframe(MyDmaBuffer_t dBuffer, uint64_t pts, uint32_t flags);
+    void signalInputAvailable();
+    void recordInputBlocked(int64_t blockTimeUs);
+
+    c2_status_t acquireStagingBuffer(uint64_t pts, MyDmaBuffer_t *outBuffer);
+    void releaseStagingBuffer(uint64_t pts);
+    void freeStagingBuffer(StagingBuffer *buffer);
+    void clearStagingBuffers();
+
+    ImportEntry* lookupImportCache(
+            int32_t fd, uint64_t bqId, uint32_t bqSlot, uint32_t generation, bool *hit);
+    MppBuffer getImportedBuffer(ImportEntry *entry, int32_t fd, int32_t size);
+    void clearImportCache();
     c2_status_t getoutpacket(MppPacket *entry);
 
+    std::vector<std::shared_ptr<C2RKSimulcastLayer>> getSimulcastLayers();
+    void sendSimulcastLayers(const std::unique_ptr<C2Work> &work, MyDmaBuffer_t dbuffer);
+    void collectSimulcastLayers(
+            uint64_t frameIndex, std::vector<std::shared_ptr<C2Buffer>> *buffers);
+    bool isPartialPacket(MppPacket packet);
+
+    uint32_t getOutputBlockSize();
+    c2_status_t attachOutputBlock(MppMeta meta, uint64_t pts);
+    void detachOutputBlock(MppMeta meta, uint64_t pts);
+    std::shared_ptr<C2LinearBlock> takeOutputBlock(MppPacket packet, uint64_t pts);
+    void clearOutputBlocks();
+
     C2_DO_NOT_COPY(C2RKMpiEnc);
 };
 
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2025 Rockchip Electronics Co. LTD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <media/stagefright/foundation/ALooper.h>
+
+#include "C2RKMppCtxPool.h"
+#include "C2RKPropsDef.h"
+#include "C2RKLogger.h"
+
+namespace android {
+
+C2_LOGGER_ENABLE("C2RKMppCtxPool");
+
+/* ready context not adopted within this time is destroyed */
+static const int64_t kIdleTimeoutUs = 30000000LL;
+
+C2RKMppCtxPool::C2RKMppCtxPool()
+    : mMaxContexts(0),
+      mStopped(false),
+      mHitCount(0),
+      mMissCount(0),
+      mEvictCount(0) {
+    if (!C2RKPropsDef::getLowMemoryMode()) {
+        mMaxContexts = C2RKPropsDef::getDecWarmContextNum();
+    }
+
+    if (mMaxContexts > 0) {
+        mWorker = std::thread([this]() {
+            pthread_setname_np(pthread_self(), "C2CtxPoolWorker");
+            workerLoop();
+        });
+    }
+
+    Log.I("max warm contexts %d", mMaxContexts);
+}
+
+C2RKMppCtxPool::~C2RKMppCtxPool() {
+    {
+        Mutex::Autolock autoLock(mLock);
+        mStopped = true;
+        mCond.broadcast();
+    }
+
+    if (mWorker.joinable()) {
+        mWorker.join();
+    }
+
+    destroyEntries(&mEntries);
+}
+
+MPP_RET C2RKMppCtxPool::createContext(const Setup &setup, MppCtx *ctx, MppApi **mpi) {
+    MppCtx   mppCtx = nullptr;
+    MppApi  *mppMpi = nullptr;
+    uint32_t value = 0;
+
+    MPP_RET err = mpp_create(&mppCtx, &mppMpi);
+    if (err != MPP_OK) {
+        Log.E("failed to create mpp context, err %d", err);
+        return err;
+    }
+
+    value = setup.fastParse;
+    err = mppMpi->control(mppCtx, MPP_DEC_SET_PARSER_FAST_MODE, &value);
+    Log.PostErrorIf(err != MPP_OK, "setParserFastMode");
+
+    value = setup.fastPlay;
+    err = mppMpi->control(mppCtx, MPP_DEC_SET_ENABLE_FAST_PLAY, &value);
+    Log.PostErrorIf(err != MPP_OK, "setEnableFastPlay");
+
+    if (!setup.deinterlace) {
+        Log.I("disable deinterlace mode");
+        value = setup.deinterlace;
+        err = mppMpi->control(mppCtx, MPP_DEC_SET_ENABLE_DEINTERLACE, &value);
+        Log.PostErrorIf(err != MPP_OK, "setEnableDeinterlace");
+    }
+
+    if (setup.splitMode) {
+        Log.I("enable parser split mode");
+        value = setup.splitMode;
+        err = mppMpi->control(mppCtx, MPP_DEC_SET_PARSER_SPLIT_MODE, &value);
+        Log.PostErrorIf(err != MPP_OK, "setParserSplitMode");
+    }
+
+    if (setup.fastOut) {
+        Log.I("enable lowLatency fast-out mode");
+        value = setup.fastOut;
+        err = mppMpi->control(mppCtx, MPP_DEC_SET_IMMEDIATE_OUT, &value);
+        Log.PostErrorIf(err != MPP_OK, "setImmediateOut");
+    }
+
+    if (setup.disableDpbCheck) {
+        Log.I("disable poc discontinuous check");
+        value = setup.disableDpbCheck;
+        err = mppMpi->control(mppCtx, MPP_DEC_SET_DISABLE_DPB_CHECK, &value);
+        Log.PostErrorIf(err != MPP_OK, "setDisableDpbCheck");
+    }
+
+    if (setup.disableErrorMark) {
+        Log.I("disable error frame mark");
+        value = setup.disableErrorMark;
+        err = mppMpi->control(mppCtx, MPP_DEC_SET_DISABLE_ERROR, &value);
+        Log.PostErrorIf(err != MPP_OK, "setDisableError");
+    }
+
+    err = mpp_init(mppCtx, MPP_CTX_DEC, setup.coding);
+    if (err != MPP_OK) {
+        Log.PostError("mpp_init", static_cast<int32_t>(err));
+        std::ignore = mpp_destroy(mppCtx);
+        return err;
+    }
+
+    *ctx = mppCtx;
+    *mpi = mppMpi;
+
+    return MPP_OK;
+}
+
+bool C2RKMppCtxPool::acquire(const Setup &setup, MppCtx *ctx, MppApi **mpi) {
+    Mutex::Autolock autoLock(mLock);
+
+    if (mMaxContexts <= 0) {
+        return false;
+    }
+
+    for (auto it = mEntries.begin(); it != mEntries.end(); it++) {
+        if (it->setup == setup) {
+            *ctx = it->ctx;
+            *mpi = it->mpi;
+            std::ignore = mEntries.erase(it);
+            mHitCount++;
+            return true;
+        }
+    }
+
+    mMissCount++;
+    return false;
+}
+
+void C2RKMppCtxPool::prepare(const Setup &setup) {
+    Mutex::Autolock autoLock(mLock);
+
+    if (mMaxContexts <= 0) {
+        return;
+    }
+
+    // one spare context is enough for each setup
+    for (const Entry &entry : mEntries) {
+        if (entry.setup == setup) {
+            return;
+        }
+    }
+    for (const Setup &request : mRequests) {
+        if (request == setup) {
+            return;
+        }
+    }
+
+    // only warm up with spare capacity, ready contexts expire when idle
+    if (mEntries.size() + mRequests.size() >= static_cast<size_t>(mMaxContexts)) {
+        return;
+    }
+
+    mRequests.push_back(setup);
+    mCond.signal();
+}
+
+void C2RKMppCtxPool::getStats(Stats *stats) {
+    Mutex::Autolock autoLock(mLock);
+
+    stats->readyCount = static_cast<int32_t>(mEntries.size());
+    stats->hitCount = mHitCount;
+    stats->missCount = mMissCount;
+    stats->evictCount = mEvictCount;
+}
+
+void C2RKMppCtxPool::evictIdle_l(int64_t nowUs, std::list<Entry> *evicted) {
+    while (!mEntries.empty() && mEntries.front().readyTimeUs + kIdleTimeoutUs <= nowUs) {
+        evicted->splice(evicted->end(), mEntries, mEntries.begin());
+        mEvictCount++;
+    }
+}
+
+void C2RKMppCtxPool::destroyEntries(std::list<Entry> *entries) {
+    for (Entry &entry : *entries) {
+        std::ignore = mpp_destroy(entry.ctx);
+    }
+    entries->clear();
+}
+
+void C2RKMppCtxPool::workerLoop() {
+    Mutex::Autolock autoLock(mLock);
+
+    while (!mStopped) {
+        std::list<Entry> evicted;
+
+        evictIdle_l(ALooper::GetNowUs(), &evicted);
+        if (!evicted.empty()) {
+            mLock.unlock();
+            Log.I("evict %zu idle contexts", evicted.size());
+            destroyEntries(&evicted);
+            mLock.lock();
+            continue;
+        }
+
+        if (mRequests.empty()) {
+            if (mEntries.empty()) {
+                std::ignore = mCond.wait(mLock);
+            } else {
+                int64_t waitUs = mEntries.front().readyTimeUs
+                        + kIdleTimeoutUs - ALooper::GetNowUs();
+                std::ignore = mCond.waitRelative(mLock, waitUs * 1000LL);
+            }
+            continue;
+        }
+
+        Setup setup = mRequests.front();
+        mRequests.pop_front();
+
+        mLock.unlock();
+
+        Entry entry = { setup, nullptr, nullptr, 0 };
+        MPP_RET err = createContext(setup, &entry.ctx, &entry.mpi);
+
+        mLock.lock();
+
+        if (err != MPP_OK) {
+            continue;
+        }
+
+        if (mEntries.size() >= static_cast<size_t>(mMaxContexts)) {
+            mLock.unlock();
+            Log.D("pool is full, drop context of coding %d", setup.coding);
+            std::ignore = mpp_destroy(entry.ctx);
+            mLock.lock();
+            continue;
+        }
+
+        entry.readyTimeUs = ALooper::GetNowUs();
+        mEntries.push_back(entry);
+        Log.D("context of coding %d ready", setup.coding);
+    }
+}
+
+} // namespace android
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2025 Rockchip Electronics Co. LTD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_C2_RK_MPP_CTX_POOL_H_
+#define ANDROID_C2_RK_MPP_CTX_POOL_H_
+
+#include <stdint.h>
+#include <list>
+#include <thread>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+
+#include "rk_mpi.h"
+
+namespace android {
+
+/*
+ * Pre-initialized decoder contexts for fast decoder restart, such as channel
+ * switching which releases a decoder and creates a new one of the same kind.
+ * A context is prepared in background once a decoder is released and the
+ * pool has room, and the next decoder with the same setup adopts it instead
+ * of mpp_create/mpp_init.
+ *
+ * Only fresh contexts are kept, a used context is never recycled since it
+ * holds configs and buffers of the previous session.
+ */
+class C2RKMppCtxPool {
+public:
+    /* decoder setup which only takes effect before mpp_init */
+    struct Setup {
+        MppCodingType coding;
+        uint32_t fastParse;
+        uint32_t fastPlay;
+        uint32_t deinterlace;
+        uint32_t splitMode;
+        uint32_t fastOut;
+        uint32_t disableDpbCheck;
+        uint32_t disableErrorMark;
+
+        bool operator==(const Setup &o) const {
+            return coding == o.coding && fastParse == o.fastParse &&
+                    fastPlay == o.fastPlay && deinterlace == o.deinterlace &&
+                    splitMode == o.splitMode && fastOut == o.fastOut &&
+                    disableDpbCheck == o.disableDpbCheck &&
+                    disableErrorMark == o.disableErrorMark;
+        }
+    };
+
+    struct Stats {
+        int32_t readyCount;
+        int64_t hitCount;
+        int64_t missCount;
+        int64_t evictCount;
+    };
+
+    static C2RKMppCtxPool* get() {
+        static C2RKMppCtxPool _gInstance;
+        return &_gInstance;
+    }
+
+    // create and init a decoder context with setup
+    static MPP_RET createContext(const Setup &setup, MppCtx *ctx, MppApi **mpi);
+
+    // take a pre-initialized context of setup, returns false if none ready
+    bool acquire(const Setup &setup, MppCtx *ctx, MppApi **mpi);
+
+    // prepare a context of setup in background for the next acquire
+    void prepare(const Setup &setup);
+
+    void getStats(Stats *stats);
+
+private:
+    struct Entry {
+        Setup   setup;
+        MppCtx  ctx;
+        MppApi *mpi;
+        int64_t readyTimeUs;
+    };
+
+    C2RKMppCtxPool();
+    ~C2RKMppCtxPool();
+
+    void workerLoop();
+    void evictIdle_l(int64_t nowUs, std::list<Entry> *evicted);
+    static void destroyEntries(std::list<Entry> *entries);
+
+    Mutex             mLock;
+    Condition         mCond;
+    std::list<Entry>  mEntries;     // ready contexts, oldest first
+    std::list<Setup>  mRequests;    // contexts to prepare
+    std::thread       mWorker;
+    int32_t           mMaxContexts;
+    bool              mStopped;
+
+    int64_t           mHitCount;
+    int64_t           mMissCount;
+    int64_t           mEvictCount;
+};
+
+} // namespace android
+
+#endif  // ANDROID_C2_RK_MPP_CTX_POOL_H_
@@ -30,31 +30,196 @@ C2_LOGGER_ENABLE("C2RKNaluParser");
 #define H264_PROFILE_IDC_HIGH10       110
 #define H265_MAX_VPS_COUNT             16
 #define H265_MAX_SUB_LAYERS             7
+#define H265_MAX_DPB_SIZE              16
+#define H264_MAX_DPB_FRAMES            16
+#define H264_MAX_CPB_COUNT             32
 #define H265_PROFILE_IDC_MAIN_10        2
 #define H265_NALU_TYPE_VPS             32
 #define H265_NALU_TYPE_SPS             33
 
-/* find h2645 start code */
-int32_t findStartCode(uint8_t *buf, int32_t size) {
-    if (size < 4)
-        return 0;
+#define NALU_TABLE_RESERVE_SIZE         16
 
+bool C2RKNaluParser::isAnnexBStream(uint8_t *buf, int32_t size) {
     // start code: 0x000001 or 0x00000001
-    if (buf[0] == 0x00 && buf[1] == 0x00 && buf[2] == 0x01) {
-        return 3;
-    } else if (buf[0] == 0x00 && buf[1] == 0x00 && buf[2] == 0x00 && buf[3] == 0x01) {
-        return 4;
-    } else {
-        // TODO(@TEAM) loop find start code
+    return (size >= 4 && buf[0] == 0x00 && buf[1] == 0x00 && buf[2] <= 0x01);
+}
+
+int32_t C2RKNaluParser::buildNaluTable(
+        uint8_t *buf, int32_t size, int32_t coding, std::vector<NaluEntry> *table) {
+    NaluEntry *last = nullptr;
+    uint8_t *end = buf + size;
+    uint8_t *pos = buf + 2;
+
+    table->clear();
+
+    if (buf == nullptr || size < 4) {
         return 0;
     }
+
+    table->reserve(NALU_TABLE_RESERVE_SIZE);
+
+    /*
+     * Search 0x01 byte by memchr, which is vectorized in libc, and then
+     * check the two zero bytes before it. Most bytes of the slice data are
+     * skipped without per-byte comparison.
+     */
+    while (pos < end) {
+        uint8_t *one = static_cast<uint8_t *>(memchr(pos, 0x01, end - pos));
+        if (one == nullptr) {
+            break;
+        }
+
+        if (one[-1] != 0x00 || one[-2] != 0x00) {
+            pos = one + 1;
+            continue;
+        }
+
+        // close previous nal unit, the zero byte of 4-byte start code is excluded
+        if (last != nullptr) {
+            uint8_t *nalEnd = one - 2;
+            if (nalEnd - 1 >= buf + last->offset && nalEnd[-1] == 0x00) {
+                nalEnd--;
+            }
+            last->size = static_cast<int32_t>(nalEnd - buf) - last->offset;
+        }
+
+        if (one + 1 >= end) {
+            break;
+        }
+
+        NaluEntry entry;
+        entry.offset = static_cast<int32_t>(one + 1 - buf);
+        entry.size = static_cast<int32_t>(end - one - 1);
+        if (coding == MPP_VIDEO_CodingHEVC) {
+            entry.type = (one[1] >> 1) & 0x3f;
+        } else {
+            entry.type = one[1] & 0x1f;
+        }
+        table->push_back(entry);
+        last = &table->back();
+
+        pos = one + 3;
+    }
+
+    return static_cast<int32_t>(table->size());
 }
 
-bool C2RKNaluParser::searchAVCNaluInfo(
+bool C2RKNaluParser::searchAVCHrdParams(BitReadContext *gb) {
+    int32_t val = 0, cpbCount = 0, i = 0;
+
+    READ_UE(gb, &cpbCount);  // cpb_cnt_minus1
+    if (cpbCount >= H264_MAX_CPB_COUNT) {
+        Log.E("cpb_cnt_minus1 out of range: %d", cpbCount);
+        goto error;
+    }
+
+    SKIP_BITS(gb, 8);  // bit_rate_scale & cpb_size_scale
+    for (i = 0; i <= cpbCount; i++) {
+        READ_UE(gb, &val);  // bit_rate_value_minus1
+        READ_UE(gb, &val);  // cpb_size_value_minus1
+        SKIP_BITS(gb, 1);   // cbr_flag
+    }
+    // initial_cpb_removal_delay_length & cpb_removal_delay_length
+    // dpb_output_delay_length & time_offset_length
+    SKIP_BITS(gb, 20);
+
+    return true;
+
+__BR_ERR:
+error:
+    return false;
+}
+
+bool C2RKNaluParser::searchAVCNalVui(BitReadContext *gb, int32_t *outValue) {
+    int32_t val = 0;
+    int32_t nalHrdFlag = 0, vclHrdFlag = 0;
+    int32_t maxNumReorder = 0, maxDecBuffering = 0;
+
+    READ_ONEBIT(gb, &val);  // aspect_ratio_info_present_flag
+    if (val) {
+        READ_BITS(gb, 8, &val);  // aspect_ratio_idc
+        if (val == 255) {  // Extended_SAR
+            SKIP_BITS(gb, 32);
+        }
+    }
+
+    READ_ONEBIT(gb, &val);  // overscan_info_present_flag
+    if (val) {
+        SKIP_BITS(gb, 1);  // overscan_appropriate_flag
+    }
+
+    READ_ONEBIT(gb, &val);  // video_signal_type_present_flag
+    if (val) {
+        SKIP_BITS(gb, 4);  // video_format & video_full_range_flag
+        READ_ONEBIT(gb, &val);  // colour_description_present_flag
+        if (val) {
+            SKIP_BITS(gb, 24);
+        }
+    }
+
+    READ_ONEBIT(gb, &val);  // chroma_loc_info_present_flag
+    if (val) {
+        READ_UE(gb, &val);  // chroma_sample_loc_type_top_field
+        READ_UE(gb, &val);  // chroma_sample_loc_type_bottom_field
+    }
+
+    READ_ONEBIT(gb, &val);  // timing_info_present_flag
+    if (val) {
+        SKIP_BITS_LONG(gb, 32);  // num_units_in_tick
+        SKIP_BITS_LONG(gb, 32);  // time_scale
+        SKIP_BITS(gb, 1);  // fixed_frame_rate_flag
+    }
+
+    READ_ONEBIT(gb, &nalHrdFlag);  // nal_hrd_parameters_present_flag
+    if (nalHrdFlag && !searchAVCHrdParams(gb)) {
+        goto error;
+    }
+    READ_ONEBIT(gb, &vclHrdFlag);  // vcl_hrd_parameters_present_flag
+    if (vclHrdFlag && !searchAVCHrdParams(gb)) {
+        goto error;
+    }
+    if (nalHrdFlag || vclHrdFlag) {
+        SKIP_BITS(gb, 1);  // low_delay_hrd_flag
+    }
+
+    SKIP_BITS(gb, 1);  // pic_struct_present_flag
+
+    READ_ONEBIT(gb, &val);  // bitstream_restriction_flag
+    if (!val) {
+        Log.D("no bitstream restriction in AVC vui");
+        goto error;
+    }
+
+    SKIP_BITS(gb, 1);  // motion_vectors_over_pic_boundaries_flag
+    READ_UE(gb, &val);  // max_bytes_per_pic_denom
+    READ_UE(gb, &val);  // max_bits_per_mb_denom
+    READ_UE(gb, &val);  // log2_max_mv_length_horizontal
+    READ_UE(gb, &val);  // log2_max_mv_length_vertical
+    READ_UE(gb, &maxNumReorder);  // max_num_reorder_frames
+    READ_UE(gb, &maxDecBuffering);  // max_dec_frame_buffering
+
+    if (maxDecBuffering > H264_MAX_DPB_FRAMES || maxNumReorder > maxDecBuffering) {
+        Log.E("invalid AVC dpb info, maxDecBuffering %d maxNumReorder %d",
+               maxDecBuffering, maxNumReorder);
+        goto error;
+    }
+
+    outValue[0] = maxDecBuffering;
+    outValue[1] = maxNumReorder;
+    Log.D("get AVC stream maxDecBuffering %d maxNumReorder %d",
+           maxDecBuffering, maxNumReorder);
+
+    return true;
+
+__BR_ERR:
+error:
+    return false;
+}
+
+bool C2RKNaluParser::searchAVCNalSPS(
         uint8_t *buf, int32_t size, int32_t detectFiled, int32_t *outValue) {
     BitReadContext  gbCtx;
     BitReadContext *gb = &gbCtx;
-    int32_t startCodeLen = 0;
     int32_t val = 0, i = 0;
     int32_t profileIdc = 0, chromaFormatIdc = 0;
 
@@ -65,23 +230,6 @@ bool C2RKNaluParser::searchAVCNaluInfo(
         goto error;
     }
 
-    /*
-     * ExtraData carry h264 sps_info in two ways.
-     * 1. start with 0x000001 or 0x00000001
-     * 2. AVC extraData configuration
-     */
-
-    startCodeLen = findStartCode(buf, size);
-    if (startCodeLen > 0) {
-        SKIP_BITS(gb, startCodeLen * 8);
-    } else {
-        // AVC extraData configuration
-        SKIP_BITS(gb, 32);
-        SKIP_BITS(gb, 16);
-
-        SKIP_BITS(gb, 16);  // sequenceParameterSetLength
-    }
-
     /* parse h264 sps info */
     READ_ONEBIT(gb, &val);  // forbidden_bit
 
@@ -184,11 +332,14 @@ bool C2RKNaluParser::searchAVCNaluInfo(
         READ_UE(gb, &val);  // log2_max_pic_order_cnt_lsb_minus4
         if (val >= 13) goto __BR_ERR;
     } else if (val == 1) {
+        int32_t numRefFramesInCycle = 0;
+
         READ_ONEBIT(gb, &val);
         READ_SE(gb, &val);
         READ_SE(gb, &val);
-        READ_UE(gb, &val);  // num_ref_frames_in_pic_order_cnt_cycle
-        for (i = 0; i < val; ++i) {
+        READ_UE(gb, &numRefFramesInCycle);  // num_ref_frames_in_pic_order_cnt_cycle
+        if (numRefFramesInCycle > 255) goto __BR_ERR;
+        for (i = 0; i < numRefFramesInCycle; ++i) {
             READ_SE(gb, &val);
         }
     } else if (val >= 3) {
@@ -202,14 +353,74 @@ bool C2RKNaluParser::searchAVCNaluInfo(
         return true;
     }
 
+    SKIP_BITS(gb, 1);  // gaps_in_frame_num_value_allowed_flag
+    READ_UE(gb, &val);  // pic_width_in_mbs_minus1
+    READ_UE(gb, &val);  // pic_height_in_map_units_minus1
+    READ_ONEBIT(gb, &val);  // frame_mbs_only_flag
+    if (!val) {
+        SKIP_BITS(gb, 1);  // mb_adaptive_frame_field_flag
+    }
+    SKIP_BITS(gb, 1);  // direct_8x8_inference_flag
+
+    READ_ONEBIT(gb, &val);  // frame_cropping_flag
+    if (val) {
+        for (i = 0; i < 4; i++) {
+            READ_UE(gb, &val);  // frame_crop_offset
+        }
+    }
+
+    READ_ONEBIT(gb, &val);  // vui_parameters_present_flag
+    if (val && detectFiled == C2_DETECT_FIELD_DPB_INFO) {
+        return searchAVCNalVui(gb, outValue);
+    }
+
 __BR_ERR:
 error:
     return false;
 }
 
+bool C2RKNaluParser::searchAVCNaluInfo(
+        uint8_t *buf, int32_t size, int32_t detectFiled, int32_t *outValue) {
+    /*
+     * ExtraData carry h264 sps_info in two ways.
+     * 1. start with 0x000001 or 0x00000001
+     * 2. AVC extraData configuration
+     */
+    if (isAnnexBStream(buf, size)) {
+        std::vector<NaluEntry> table;
+
+        buildNaluTable(buf, size, MPP_VIDEO_CodingAVC, &table);
+        for (const NaluEntry &entry : table) {
+            if (entry.type != H264_NALU_TYPE_SPS) {
+                continue;
+            }
+            if (searchAVCNalSPS(buf + entry.offset, entry.size, detectFiled, outValue)) {
+                return true;
+            }
+        }
+    } else if (size > 8) {
+        // AVC extraData configuration, take the first sps
+        int32_t spsLen = buf[6] << 8 | buf[7];
+
+        if (spsLen > size - 8) {
+            spsLen = size - 8;
+        }
+        if (searchAVCNalSPS(buf + 8, spsLen, detectFiled, outValue)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 bool C2RKNaluParser::searchHEVCNalSPS(
         BitReadContext *gb, int32_t detectFiled, int32_t *outValue) {
-    int32_t val = 0;
+    int32_t val = 0, i = 0;
+    int32_t maxSubLayers = 0;
+    uint8_t subLayerProfilePresentFlag[7];
+    uint8_t subLayerLevelPresentFlag[7];
+    uint8_t subLayerOrderingInfoPresentFlag = 0;
+    int32_t maxDecBuffering = 0, maxNumReorder = 0;
 
     READ_BITS(gb, 4, &val); // vps-id
     if (val > H265_MAX_VPS_COUNT) {
@@ -217,11 +428,11 @@ bool C2RKNaluParser::searchHEVCNalSPS(
         goto error;
     }
 
-    READ_BITS(gb, 3, &val);
-    val += 1;
+    READ_BITS(gb, 3, &maxSubLayers);
+    maxSubLayers += 1;
 
-    if (val > H265_MAX_SUB_LAYERS) {
-        Log.E("sps_max_sub_layers out of range: %d", val);
+    if (maxSubLayers > H265_MAX_SUB_LAYERS) {
+        Log.E("sps_max_sub_layers out of range: %d", maxSubLayers);
         goto error;
     }
 
@@ -240,6 +451,71 @@ bool C2RKNaluParser::searchHEVCNalSPS(
         return true;
     }
 
+    if (detectFiled != C2_DETECT_FIELD_DPB_INFO) {
+        goto error;
+    }
+
+    SKIP_BITS(gb, 80);  // rest of general profile_tier_level
+    SKIP_BITS(gb, 8);  // general_ptl.level_idc
+
+    for (i = 0; i < maxSubLayers - 1; i++) {
+        READ_ONEBIT(gb, &subLayerProfilePresentFlag[i]);
+        READ_ONEBIT(gb, &subLayerLevelPresentFlag[i]);
+    }
+    if (maxSubLayers - 1 > 0) {
+        for (i = maxSubLayers - 1; i < 8; i++)
+            SKIP_BITS(gb, 2);  // reserved_zero_2bits[i]
+    }
+    for (i = 0; i < maxSubLayers - 1; i++) {
+        if (subLayerProfilePresentFlag[i]) {
+            SKIP_BITS(gb, 88);  // profile_tier_level
+        }
+        if (subLayerLevelPresentFlag[i])
+            SKIP_BITS(gb, 8);  // sub_layer_ptl[i].level_idc
+    }
+
+    READ_UE(gb, &val);  // sps_seq_parameter_set_id
+    READ_UE(gb, &val);  // chroma_format_idc
+    if (val == 3) {
+        SKIP_BITS(gb, 1);  // separate_colour_plane_flag
+    }
+    READ_UE(gb, &val);  // pic_width_in_luma_samples
+    READ_UE(gb, &val);  // pic_height_in_luma_samples
+
+    READ_ONEBIT(gb, &val);  // conformance_window_flag
+    if (val) {
+        for (i = 0; i < 4; i++) {
+            READ_UE(gb, &val);  // conf_win_offset
+        }
+    }
+
+    READ_UE(gb, &val);  // bit_depth_luma_minus8
+    READ_UE(gb, &val);  // bit_depth_chroma_minus8
+    READ_UE(gb, &val);  // log2_max_pic_order_cnt_lsb_minus4
+
+    READ_ONEBIT(gb, &subLayerOrderingInfoPresentFlag);
+
+    // values of the highest sub-layer take effect when decoding all layers
+    i = subLayerOrderingInfoPresentFlag ? 0 : maxSubLayers - 1;
+    for (; i < maxSubLayers; i++) {
+        READ_UE(gb, &maxDecBuffering);  // sps_max_dec_pic_buffering_minus1
+        READ_UE(gb, &maxNumReorder);  // sps_max_num_reorder_pics
+        READ_UE(gb, &val);  // sps_max_latency_increase_plus1
+    }
+
+    if (maxDecBuffering > H265_MAX_DPB_SIZE - 1 || maxNumReorder > maxDecBuffering) {
+        Log.E("invalid HEVC dpb info, maxDecBuffering %d maxNumReorder %d",
+               maxDecBuffering, maxNumReorder);
+        goto error;
+    }
+
+    outValue[0] = maxDecBuffering;
+    outValue[1] = maxNumReorder;
+    Log.D("get HEVC stream maxDecBuffering %d maxNumReorder %d",
+           maxDecBuffering, maxNumReorder);
+
+    return true;
+
 __BR_ERR:
 error:
     return false;
@@ -396,7 +672,11 @@ error:
 
 bool C2RKNaluParser::searchHEVCNaluInfo(
         uint8_t *buf, int32_t size, int32_t detectFiled, int32_t *outValue) {
-    if (buf[0] || buf[1] || buf[2] > 1) {
+    if (size < 4) {
+        goto error;
+    }
+
+    if (!isAnnexBStream(buf, size)) {
         int32_t i = 0, j = 0;
         int32_t nalLenSize = 0;
         uint32_t numOfArrays = 0, numOfNals = 0;
@@ -446,23 +726,20 @@ bool C2RKNaluParser::searchHEVCNaluInfo(
             }
         }
     } else {
-        int32_t i = 0;
+        std::vector<NaluEntry> table;
         int32_t detectNaluType = H265_NALU_TYPE_SPS;
 
         if (detectFiled == C2_DETECT_FIELD_MAX_REF_COUNT) {
             detectNaluType = H265_NALU_TYPE_VPS;
         }
 
-        for (i = 0; i < size - 4; i++) {
-            // find start code
-            if (buf[i] == 0x00 && buf[i + 1] == 0x00 &&
-                buf[i + 2] == 0x01 && ((buf[i + 3] & 0x7f) >> 1) == detectNaluType) {
-                Log.D("find h265 start code");
-                i += 3;
-                if (searchHEVCNalUnit(buf + i, size - i, detectFiled, outValue)) {
-                    return true;
-                }
-
+        buildNaluTable(buf, size, MPP_VIDEO_CodingHEVC, &table);
+        for (const NaluEntry &entry : table) {
+            if (entry.type != detectNaluType) {
+                continue;
+            }
+            if (searchHEVCNalUnit(buf + entry.offset, entry.size, detectFiled, outValue)) {
+                return true;
             }
         }
     }
@@ -521,4 +798,32 @@ int32_t C2RKNaluParser::detectMaxRefCount(uint8_t *buf, int32_t size, int32_t co
     return maxRefCount;
 }
 
-} // namespace android
\ No newline at end of file
+bool C2RKNaluParser::detectDpbInfo(
+        uint8_t *buf, int32_t size, int32_t coding,
+        int32_t *maxDecBuffering, int32_t *maxNumReorder) {
+    int32_t dpbInfo[2] = { 0, 0 };
+    bool found = false;
+
+    switch (coding) {
+        case MPP_VIDEO_CodingAVC: {
+            found = searchAVCNaluInfo(buf, size, C2_DETECT_FIELD_DPB_INFO, dpbInfo);
+        } break;
+        case MPP_VIDEO_CodingHEVC: {
+            found = searchHEVCNaluInfo(buf, size, C2_DETECT_FIELD_DPB_INFO, dpbInfo);
+        } break;
+        default: {
+            Log.D("not support coding %d", coding);
+        } break;
+    }
+
+    if (!found) {
+        Log.D("failed to find dpb info");
+        return false;
+    }
+
+    *maxDecBuffering = dpbInfo[0];
+    *maxNumReorder = dpbInfo[1];
+    return true;
+}
+
+} // namespace android
@@ -17,23 +17,55 @@
 #ifndef ANDROID_C2_RK_NALU_PARSER_H__
 #define ANDROID_C2_RK_NALU_PARSER_H__
 
+#include <vector>
+
 #include "C2RKBitReader.h"
 
 namespace android {
 
 class C2RKNaluParser {
 public:
+    /* one nal unit in annexb bitstream, offset points to the nal header */
+    struct NaluEntry {
+        int32_t offset;
+        int32_t size;
+        int32_t type;
+    };
+
+    /*
+     * Scan the whole buffer for start codes and collect all nal units,
+     * returns the count of nal units found, 0 if not a annexb stream.
+     */
+    static int32_t buildNaluTable(
+            uint8_t *buf, int32_t size, int32_t coding, std::vector<NaluEntry> *table);
+
     static int32_t detectBitDepth(uint8_t *buf, int32_t size, int32_t coding);
     static int32_t detectMaxRefCount(uint8_t *buf, int32_t size, int32_t coding);
 
+    /*
+     * Get decoded picture buffering from AVC vui bitstream_restriction or
+     * HEVC sps sub-layer ordering info of the highest sub-layer.
+     * maxDecBuffering excludes the current decoding picture.
+     */
+    static bool detectDpbInfo(
+            uint8_t *buf, int32_t size, int32_t coding,
+            int32_t *maxDecBuffering, int32_t *maxNumReorder);
+
 private:
     /* Supported lists for InputFormat */
     typedef enum {
         C2_DETECT_FIELD_DEPTH = 0,
         C2_DETECT_FIELD_MAX_REF_COUNT,
+        /* outValue[0] maxDecBuffering, outValue[1] maxNumReorder */
+        C2_DETECT_FIELD_DPB_INFO,
         C2_DETECT_FIELD_BUTT,
     } MyDetectField;
 
+    static bool isAnnexBStream(uint8_t *buf, int32_t size);
+    static bool searchAVCHrdParams(BitReadContext *gb);
+    static bool searchAVCNalVui(BitReadContext *gb, int32_t *outValue);
+    static bool searchAVCNalSPS(
+            uint8_t *buf, int32_t size, int32_t detectFiled, int32_t *outValue);
     static bool searchAVCNaluInfo(
             uint8_t *buf, int32_t size, int32_t detectFiled, int32_t *outValue);
     static bool searchHEVCNalSPS(
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2025 Rockchip Electronics Co. LTD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ui/GraphicBufferAllocator.h>
+
+#include "C2RKSimulcastLayer.h"
+#include "C2RKLogger.h"
+#include "C2RKMppErrorTrap.h"
+#include "C2RKMediaUtils.h"
+#include "C2RKRgaDef.h"
+#include "C2RKChipCapDef.h"
+#include "C2RKGraphicBufferMapper.h"
+
+namespace android {
+
+C2_LOGGER_ENABLE("C2RKSimulcastLayer");
+
+C2RKSimulcastLayer::C2RKSimulcastLayer(const Config &config)
+    : mConfig(config),
+      mMppCtx(nullptr),
+      mMppMpi(nullptr),
+      mEncCfg(nullptr),
+      mHorStride(C2_ALIGN(config.width, 16)),
+      mVerStride(C2_ALIGN(config.height, 16)),
+      mBufferHandle(nullptr),
+      mBufferFd(-1),
+      mMppBuffer(nullptr),
+      mFrameCount(0) {
+}
+
+C2RKSimulcastLayer::~C2RKSimulcastLayer() {
+    if (mMppBuffer != nullptr) {
+        std::ignore = mpp_buffer_put(mMppBuffer);
+        mMppBuffer = nullptr;
+    }
+    if (mBufferHandle != nullptr) {
+        std::ignore = GraphicBufferAllocator::get().free((buffer_handle_t)mBufferHandle);
+        mBufferHandle = nullptr;
+    }
+    if (mEncCfg != nullptr) {
+        std::ignore = mpp_enc_cfg_deinit(mEncCfg);
+        mEncCfg = nullptr;
+    }
+    if (mMppCtx != nullptr) {
+        std::ignore = mpp_destroy(mMppCtx);
+        mMppCtx = nullptr;
+    }
+}
+
+c2_status_t C2RKSimulcastLayer::init(
+        MppCodingType coding, MppCtx mainCtx, MppApi *mainMpi) {
+    MppErrorTrap err;
+    MppEncHeaderMode headerMode = MPP_ENC_HEADER_MODE_EACH_IDR;
+    int32_t bitrate = mConfig.bitrate;
+
+    Log.I("layer %d: init %dx%d bps %d",
+           mConfig.layerId, mConfig.width, mConfig.height, bitrate);
+
+    err = mpp_create(&mMppCtx, &mMppMpi);
+    if (err != MPP_OK) {
+        Log.E("layer %d: failed to create mpp context", mConfig.layerId);
+        return C2_CORRUPTED;
+    }
+
+    // packet is taken right after the main packet of the same frame
+    MppPollType timeout = MPP_POLL_BLOCK;
+    err = mMppMpi->control(mMppCtx, MPP_SET_OUTPUT_TIMEOUT, &timeout);
+    if (err != MPP_OK) {
+        Log.E("layer %d: failed to set output timeout", mConfig.layerId);
+        return C2_CORRUPTED;
+    }
+
+    err = mpp_init(mMppCtx, MPP_CTX_ENC, coding);
+    if (err != MPP_OK) {
+        Log.PostError("mpp_init", static_cast<int32_t>(err));
+        return C2_CORRUPTED;
+    }
+
+    err = mpp_enc_cfg_init(&mEncCfg);
+    if (err != MPP_OK) {
+        Log.PostError("mpp_enc_cfg_init", static_cast<int32_t>(err));
+        return C2_CORRUPTED;
+    }
+
+    // inherit rate control, gop and codec settings of main encoder
+    err = mainMpi->control(mainCtx, MPP_ENC_GET_CFG, mEncCfg);
+
+    err = mpp_enc_cfg_set_s32(mEncCfg, "prep:width", mConfig.width);
+    err = mpp_enc_cfg_set_s32(mEncCfg, "prep:height", mConfig.height);
+    err = mpp_enc_cfg_set_s32(mEncCfg, "prep:hor_stride", mHorStride);
+    err = mpp_enc_cfg_set_s32(mEncCfg, "prep:ver_stride", mVerStride);
+    err = mpp_enc_cfg_set_s32(mEncCfg, "prep:format", MPP_FMT_YUV420SP);
+
+    err = mpp_enc_cfg_set_s32(mEncCfg, "rc:bps_target", bitrate);
+    err = mpp_enc_cfg_set_s32(mEncCfg, "rc:bps_max", bitrate / 16 * 17);
+    err = mpp_enc_cfg_set_s32(mEncCfg, "rc:bps_min", bitrate / 16 * 15);
+
+    // packet of the whole frame is taken in getPacket()
+    err = mpp_enc_cfg_set_s32(mEncCfg, "split:mode", MPP_ENC_SPLIT_NONE);
+    err = mpp_enc_cfg_set_s32(mEncCfg, "split:out", 0);
+
+    err = mMppMpi->control(mMppCtx, MPP_ENC_SET_CFG, mEncCfg);
+
+    // no csd for layers, each layer stream carries its own sps/pps
+    err = mMppMpi->control(mMppCtx, MPP_ENC_SET_HEADER_MODE, &headerMode);
+    if (err != MPP_OK) {
+        Log.PostError("setLayerCfg", static_cast<int32_t>(err));
+        return C2_CORRUPTED;
+    }
+
+    uint32_t stride = 0;
+    uint64_t usage = (GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN);
+    buffer_handle_t bufferHandle;
+
+    // allocate buffer within 4G to avoid rga2 error.
+    if (C2RKChipCapDef::get()->hasRga2()) {
+        usage = RK_GRALLOC_USAGE_WITHIN_4G;
+    }
+
+    status_t status = GraphicBufferAllocator::get().allocate(
+            mHorStride, mVerStride, 0x15 /* NV12 */, 1u /* layer count */,
+            usage, &bufferHandle, &stride, "C2RKSimulcastLayer");
+    if (status != OK) {
+        Log.E("layer %d: failed to allocate staging buffer", mConfig.layerId);
+        return C2_NO_MEMORY;
+    }
+    mBufferHandle = bufferHandle;
+    mBufferFd = C2RKGraphicBufferMapper::get()->getShareFd(bufferHandle);
+
+    MppBufferInfo commit = {};
+    commit.type = MPP_BUFFER_TYPE_ION;
+    commit.fd   = mBufferFd;
+    commit.size = C2RKGraphicBufferMapper::get()->getAllocationSize(bufferHandle);
+
+    err = mpp_buffer_import(&mMppBuffer, &commit);
+    if (err != MPP_OK) {
+        Log.E("layer %d: failed to import staging buffer", mConfig.layerId);
+        return C2_CORRUPTED;
+    }
+
+    return C2_OK;
+}
+
+c2_status_t C2RKSimulcastLayer::sendFrame(
+        const Source &src, uint64_t pts, bool forceIdr) {
+    MPP_RET err = MPP_OK;
+    MppFrame frame = nullptr;
+    RgaInfo srcInfo, dstInfo;
+
+    C2RKRgaDef::SetRgaInfo(
+            &srcInfo, src.fd, src.format,
+            src.width, src.height, src.horStride, src.verStride);
+    C2RKRgaDef::SetRgaInfo(
+            &dstInfo, mBufferFd, HAL_PIXEL_FORMAT_YCrCb_NV12,
+            mConfig.width, mConfig.height, mHorStride, mVerStride);
+    if (!C2RKRgaDef::DoBlit(srcInfo, dstInfo)) {
+        Log.E("layer %d: failed to scale input", mConfig.layerId);
+        return C2_CORRUPTED;
+    }
+
+    if (forceIdr) {
+        std::ignore = mMppMpi->control(mMppCtx, MPP_ENC_SET_IDR_FRAME, nullptr);
+    }
+
+    err = mpp_frame_init(&frame);
+    if (err != MPP_OK) {
+        return C2_NO_MEMORY;
+    }
+
+    mpp_frame_set_width(frame, mConfig.width);
+    mpp_frame_set_height(frame, mConfig.height);
+    mpp_frame_set_hor_stride(frame, mHorStride);
+    mpp_frame_set_ver_stride(frame, mVerStride);
+    mpp_frame_set_fmt(frame, MPP_FMT_YUV420SP);
+    mpp_frame_set_pts(frame, pts);
+    mpp_frame_set_buffer(frame, mMppBuffer);
+
+    err = mMppMpi->encode_put_frame(mMppCtx, frame);
+    std::ignore = mpp_frame_deinit(&frame);
+    if (err != MPP_OK) {
+        Log.E("layer %d: failed to send frame, err %d", mConfig.layerId, err);
+        return C2_CORRUPTED;
+    }
+
+    Mutex::Autolock autoLock(mPendingLock);
+    mPendingPts.push_back(pts);
+
+    return C2_OK;
+}
+
+c2_status_t C2RKSimulcastLayer::getPacket(uint64_t pts, MppPacket *packet) {
+    *packet = nullptr;
+
+    while (true) {
+        uint64_t pendingPts = 0;
+        MppPacket out = nullptr;
+
+        {
+            Mutex::Autolock autoLock(mPendingLock);
+            if (mPendingPts.empty() || mPendingPts.front() > pts) {
+                return C2_NOT_FOUND;
+            }
+            pendingPts = mPendingPts.front();
+            mPendingPts.pop_front();
+        }
+
+        MPP_RET err = mMppMpi->encode_get_packet(mMppCtx, &out);
+        if (err != MPP_OK || out == nullptr) {
+            Log.E("layer %d: failed to get packet, err %d", mConfig.layerId, err);
+            return C2_CORRUPTED;
+        }
+
+        if (pendingPts == pts) {
+            *packet = out;
+            mFrameCount++;
+            return C2_OK;
+        }
+
+        // main packet of this frame never came out, such as on flush
+        std::ignore = mpp_packet_deinit(&out);
+    }
+}
+
+} // namespace android
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2025 Rockchip Electronics Co. LTD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_C2_RK_SIMULCAST_LAYER_H_
+#define ANDROID_C2_RK_SIMULCAST_LAYER_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <C2.h>
+#include <utils/Mutex.h>
+
+#include "rk_mpi.h"
+
+namespace android {
+
+/*
+ * Downscaled rendition of a simulcast encoder. The input of main encoder is
+ * scaled by rga into the staging buffer of each layer and encoded by its own
+ * mpp context, so the client buffer is mapped and imported only once for all
+ * renditions. Frames are sent to the layers before the main encoder, and the
+ * packet of a layer is taken once the main packet of the same frame is out,
+ * so the layer contexts encode in parallel with the main one.
+ */
+class C2RKSimulcastLayer {
+public:
+    struct Config {
+        int32_t layerId;
+        int32_t width;
+        int32_t height;
+        int32_t bitrate;
+    };
+
+    /* main encoder input which the layer scales from */
+    struct Source {
+        int32_t fd;
+        int32_t format;     /* hal pixel format */
+        int32_t width;
+        int32_t height;
+        int32_t horStride;
+        int32_t verStride;
+    };
+
+    explicit C2RKSimulcastLayer(const Config &config);
+    ~C2RKSimulcastLayer();
+
+    // create layer context which inherits the config of main encoder
+    c2_status_t init(MppCodingType coding, MppCtx mainCtx, MppApi *mainMpi);
+
+    // scale source into the staging buffer and send it to encoder
+    c2_status_t sendFrame(const Source &src, uint64_t pts, bool forceIdr);
+    // blocks until the packet of frame |pts| is out, packets of earlier
+    // frames are dropped. C2_NOT_FOUND if the frame was not sent.
+    c2_status_t getPacket(uint64_t pts, MppPacket *packet);
+
+    const Config& getConfig() const { return mConfig; }
+    int64_t getFrameCount() const { return mFrameCount; }
+
+private:
+    Config      mConfig;
+    MppCtx      mMppCtx;
+    MppApi     *mMppMpi;
+    MppEncCfg   mEncCfg;
+    int32_t     mHorStride;
+    int32_t     mVerStride;
+
+    /* rga destination, imported to mpp once */
+    const void *mBufferHandle;  /* buffer_handle_t */
+    int32_t     mBufferFd;
+    MppBuffer   mMppBuffer;
+
+    /* frames sent but whose packet is not taken yet, in send order */
+    Mutex                mPendingLock;
+    std::deque<uint64_t> mPendingPts;
+
+    std::atomic<int64_t> mFrameCount;
+
+    C2_DO_NOT_COPY(C2RKSimulcastLayer);
+};
+
+} // namespace android
+
+#endif  // ANDROID_C2_RK_SIMULCAST_LAYER_H_
@@ -25,6 +25,8 @@
 #include <dlfcn.h>
 #include <map>
 #include <mutex>
+#include <tuple>
+#include <utils/Timers.h>
 
 #include "C2RKPlatformSupport.h"
 #include "mpp_soc.h"
@@ -75,8 +77,8 @@ private:
     /**
      * An object encapsulating a loaded component module.
      *
-     * \todo provide a way to add traits to known components here to avoid loading the .so-s
-     * for listComponents
+     * \note traits of the components come from the component manifest, see
+     * ComponentLoader::getTraits(), so the module is only loaded on creation.
      */
     struct ComponentModule : public C2ComponentFactory,
             public std::enable_shared_from_this<ComponentModule> {
@@ -87,11 +89,6 @@ private:
                 c2_node_id_t id, std::shared_ptr<C2ComponentInterface> *interface,
                 InterfaceDeleter deleter = std::default_delete<C2ComponentInterface>()) override;
 
-        /**
-         * \returns the traits of the component in this module.
-         */
-        std::shared_ptr<const C2Component::Traits> getTraits();
-
         /**
          * Creates an uninitialized component module.
          *
@@ -129,9 +126,6 @@ private:
         typedef void (*DestroyRKCodec2FactoryFunc)(::C2ComponentFactory*);
 
     protected:
-        std::recursive_mutex mLock; ///< lock protecting mTraits
-        std::shared_ptr<C2Component::Traits> mTraits; ///< cached component traits
-
         c2_status_t mInit; ///< initialization result
 
         void *mLibHandle; ///< loaded library handle
@@ -177,15 +171,22 @@ private:
         }
 
         /**
-         * Creates a component loader for a specific library path (or name).
+         * \returns the traits of the component, without loading the module.
+         */
+        std::shared_ptr<const C2Component::Traits> getTraits() const {
+            return mTraits;
+        }
+
+        /**
+         * Creates a component loader for a component manifest entry.
          */
-        ComponentLoader(std::string compoenentName)
-            : mComponentName(compoenentName) {}
+        ComponentLoader(const C2RKComponentEntry &entry);
 
     private:
         std::mutex mMutex; ///< mutex guarding the module
         std::weak_ptr<ComponentModule> mModule; ///< weak reference to the loaded module
-        std::string mComponentName; ///< library path
+        std::string mComponentName; ///< component name
+        std::shared_ptr<const C2Component::Traits> mTraits; ///< traits from manifest
     };
 
     struct Interface : public C2InterfaceHelper {
@@ -303,103 +304,6 @@ c2_status_t C2RKComponentStore::ComponentModule::init(std::string componentName)
         mInit = C2_OK;
     }
 
-    if (mInit != C2_OK) {
-        return mInit;
-    }
-
-    std::shared_ptr<C2ComponentInterface> intf;
-    c2_status_t res = createInterface(0, &intf);
-    if (res != C2_OK) {
-        ALOGD("failed to create interface: %d", res);
-        return mInit;
-    }
-
-    std::shared_ptr<C2Component::Traits> traits(new (std::nothrow) C2Component::Traits);
-    if (traits) {
-        traits->name = intf->getName();
-
-        C2ComponentKindSetting kind;
-        C2ComponentDomainSetting domain;
-        res = intf->query_vb({ &kind, &domain }, {}, C2_MAY_BLOCK, nullptr);
-        bool fixDomain = res != C2_OK;
-        if (res == C2_OK) {
-            traits->kind = kind.value;
-            traits->domain = domain.value;
-        } else {
-            // TODO: remove this fall-back
-            ALOGD("failed to query interface for kind and domain: %d", res);
-
-            traits->kind =
-                (traits->name.find("encoder") != std::string::npos) ? C2Component::KIND_ENCODER :
-                (traits->name.find("decoder") != std::string::npos) ? C2Component::KIND_DECODER :
-                C2Component::KIND_OTHER;
-        }
-
-        uint32_t mediaTypeIndex =
-                traits->kind == C2Component::KIND_ENCODER ? C2PortMediaTypeSetting::output::PARAM_TYPE
-                : C2PortMediaTypeSetting::input::PARAM_TYPE;
-        std::vector<std::unique_ptr<C2Param>> params;
-        res = intf->query_vb({}, { mediaTypeIndex }, C2_MAY_BLOCK, &params);
-        if (res != C2_OK) {
-            ALOGD("failed to query interface: %d", res);
-            return mInit;
-        }
-        if (params.size() != 1u) {
-            ALOGD("failed to query interface: unexpected vector size: %zu", params.size());
-            return mInit;
-        }
-        C2PortMediaTypeSetting *mediaTypeConfig = C2PortMediaTypeSetting::From(params[0].get());
-        if (mediaTypeConfig == nullptr) {
-            ALOGD("failed to query media type");
-            return mInit;
-        }
-        traits->mediaType =
-            std::string(mediaTypeConfig->m.value,
-                        strnlen(mediaTypeConfig->m.value, mediaTypeConfig->flexCount()));
-
-        if (fixDomain) {
-            if (strncmp(traits->mediaType.c_str(), "audio/", 6) == 0) {
-                traits->domain = C2Component::DOMAIN_AUDIO;
-            } else if (strncmp(traits->mediaType.c_str(), "video/", 6) == 0) {
-                traits->domain = C2Component::DOMAIN_VIDEO;
-            } else if (strncmp(traits->mediaType.c_str(), "image/", 6) == 0) {
-                traits->domain = C2Component::DOMAIN_IMAGE;
-            } else {
-                traits->domain = C2Component::DOMAIN_OTHER;
-            }
-        }
-
-        // TODO: get this properly from the store during emplace
-        switch (traits->domain) {
-        case C2Component::DOMAIN_AUDIO:
-            traits->rank = 8;
-            break;
-        default:
-            traits->rank = 128;
-        }
-
-        params.clear();
-        res = intf->query_vb({}, { C2ComponentAliasesSetting::PARAM_TYPE }, C2_MAY_BLOCK, &params);
-        if (res == C2_OK && params.size() == 1u) {
-            C2ComponentAliasesSetting *aliasesSetting =
-                C2ComponentAliasesSetting::From(params[0].get());
-            if (aliasesSetting) {
-                // Split aliases on ','
-                // This looks simpler in plain C and even std::string would still make a copy.
-                char *aliases = ::strndup(aliasesSetting->m.value, aliasesSetting->flexCount());
-                ALOGD("'%s' has aliases: '%s'", intf->getName().c_str(), aliases);
-
-                for (char *tok, *ptr, *str = aliases; (tok = ::strtok_r(str, ",", &ptr));
-                        str = nullptr) {
-                    traits->aliases.push_back(tok);
-                    ALOGD("adding alias: '%s'", tok);
-                }
-                free(aliases);
-            }
-        }
-    }
-    mTraits = traits;
-
     return mInit;
 }
 
@@ -447,9 +351,43 @@ c2_status_t C2RKComponentStore::ComponentModule::createComponent(
     return res;
 }
 
-std::shared_ptr<const C2Component::Traits> C2RKComponentStore::ComponentModule::getTraits() {
-    std::unique_lock<std::recursive_mutex> lock(mLock);
-    return mTraits;
+C2RKComponentStore::ComponentLoader::ComponentLoader(const C2RKComponentEntry &entry)
+    : mComponentName(entry.name) {
+    std::shared_ptr<C2Component::Traits> traits(new (std::nothrow) C2Component::Traits);
+    if (!traits) {
+        return;
+    }
+
+    /*
+     * Traits were queried from the component interface before, which needs
+     * to load the component library and create a interface for each codec.
+     * All of them are known in the manifest, keep them consistent with the
+     * interface setup in C2RKMpiDec/C2RKMpiEnc.
+     */
+    traits->name = entry.name;
+    traits->kind = entry.kind;
+    traits->mediaType = entry.mime;
+
+    if (strncmp(traits->mediaType.c_str(), "audio/", 6) == 0) {
+        traits->domain = C2Component::DOMAIN_AUDIO;
+    } else if (strncmp(traits->mediaType.c_str(), "video/", 6) == 0) {
+        traits->domain = C2Component::DOMAIN_VIDEO;
+    } else if (strncmp(traits->mediaType.c_str(), "image/", 6) == 0) {
+        traits->domain = C2Component::DOMAIN_IMAGE;
+    } else {
+        traits->domain = C2Component::DOMAIN_OTHER;
+    }
+
+    // TODO: get this properly from the store during emplace
+    switch (traits->domain) {
+    case C2Component::DOMAIN_AUDIO:
+        traits->rank = 8;
+        break;
+    default:
+        traits->rank = 128;
+    }
+
+    mTraits = traits;
 }
 
 bool isHardwareSupport(C2String name) {
@@ -466,19 +404,25 @@ C2RKComponentStore::C2RKComponentStore()
     : mVisited(false),
       mReflector(std::make_shared<C2ReflectorHelper>()),
       mInterface(mReflector) {
-    auto emplace = [this](const char *componentName) {
-        auto result = mComponents.emplace(componentName, componentName);
+    auto emplace = [this](const C2RKComponentEntry &entry) {
+        auto result = mComponents.emplace(std::piecewise_construct,
+                std::forward_as_tuple(entry.name), std::forward_as_tuple(entry));
         if (!result.second) {
-            ALOGD("component %s already exists", componentName);
+            ALOGD("component %s already exists", entry.name.c_str());
         }
     };
 
-   for (int i = 0; i < sComponentMapsSize; ++i) {
+    int64_t startUs = systemTime() / 1000;
+
+    for (int i = 0; i < sComponentMapsSize; ++i) {
         if (isHardwareSupport(sComponentMaps[i].name)) {
             ALOGD("plugin %s", sComponentMaps[i].name.c_str());
-            emplace(sComponentMaps[i].name.c_str());
+            emplace(sComponentMaps[i]);
         }
     }
+
+    ALOGD("store created with %zu components in %lld us",
+          mComponents.size(), (long long)(systemTime() / 1000 - startUs));
 }
 
 c2_status_t C2RKComponentStore::copyBuffer(
@@ -507,13 +451,9 @@ void C2RKComponentStore::visitComponents() {
         return;
     }
     for (auto &nameAndLoader : mComponents) {
-        ComponentLoader &loader = nameAndLoader.second;
-        std::shared_ptr<ComponentModule> module;
-        if (loader.fetchModule(&module) == C2_OK) {
-            std::shared_ptr<const C2Component::Traits> traits = module->getTraits();
-            if (traits) {
-                mComponentList.push_back(traits);
-            }
+        std::shared_ptr<const C2Component::Traits> traits = nameAndLoader.second.getTraits();
+        if (traits) {
+            mComponentList.push_back(traits);
         }
     }
     mVisited = true;